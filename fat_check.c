@@ -0,0 +1,249 @@
+//
+// Created by root on 10/18/26.
+//
+
+#include "fat_check.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <string.h>
+
+//internal
+
+struct fsck_item_t {
+    uint32_t size;
+    uint16_t first_cluster;
+    uint8_t attributes;
+    char name[13];
+};
+
+struct fsck_ctx_t {
+    const struct volume_t *volume;
+    uint32_t clusters_limit; //first cluster number past the data area
+
+    struct fsck_item_t *items;
+    uint32_t items_count;
+    uint32_t items_capacity;
+
+    //owner of every cluster: item index + 1, 0 when nobody claimed it yet
+    atomic_uint_least32_t *owners;
+    atomic_uint_least32_t next_item;
+
+    atomic_uint_least32_t clusters_used;
+    atomic_uint_least32_t cross_linked;
+    atomic_uint_least32_t loops;
+    atomic_uint_least32_t out_of_range;
+    atomic_uint_least32_t size_mismatches;
+    atomic_uint_least32_t issues_count;
+
+    struct fsck_report_t *report;
+};
+
+static void add_issue(struct fsck_ctx_t *ctx, uint8_t kind, const char *name, uint16_t cluster) {
+    uint32_t idx = atomic_fetch_add(&ctx->issues_count, 1);
+    if (idx >= FSCK_MAX_ISSUES)
+        return;
+
+    struct fsck_issue_t *issue = ctx->report->issues + idx;
+    issue->kind = kind;
+    issue->cluster = cluster;
+    strcpy(issue->name, name);
+}
+
+static int add_item(void *arg, const struct SFN *entry, const char *path) {
+    struct fsck_ctx_t *ctx = arg;
+    if (ctx->items_count == ctx->items_capacity) {
+        uint32_t new_capacity = ctx->items_capacity == 0 ? 64 : ctx->items_capacity * 2;
+        struct fsck_item_t *new_items = realloc(ctx->items, new_capacity * sizeof(struct fsck_item_t));
+        if (new_items == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        ctx->items = new_items;
+        ctx->items_capacity = new_capacity;
+    }
+
+    struct fsck_item_t *item = ctx->items + ctx->items_count++;
+    item->size = entry->size;
+    item->first_cluster = entry->low_order_address_of_first_cluster;
+    item->attributes = entry->file_attributes;
+    //issues are reported with the 8.3 name, which is the last part of the path
+    const char *name = strrchr(path, '\\');
+    strcpy(item->name, name != NULL ? name + 1 : path);
+    return 0;
+}
+
+static uint32_t check_chain(struct fsck_ctx_t *ctx, uint32_t item_idx) {
+    const struct fsck_item_t *item = ctx->items + item_idx;
+    const uint32_t owner = item_idx + 1;
+    uint16_t cluster = item->first_cluster;
+    uint32_t length = 0;
+
+    //empty file doesn't own any cluster
+    if (cluster != FAT_FREE_CLUSTER) {
+        while (1) {
+            if (!volume_cluster_in_range(ctx->volume, cluster)) {
+                atomic_fetch_add(&ctx->out_of_range, 1);
+                add_issue(ctx, FSCK_OUT_OF_RANGE, item->name, cluster);
+                return length;
+            }
+
+            uint_least32_t current = 0;
+            if (!atomic_compare_exchange_strong(ctx->owners + cluster, &current, owner)) {
+                if (current == owner) {
+                    atomic_fetch_add(&ctx->loops, 1);
+                    add_issue(ctx, FSCK_LOOP, item->name, cluster);
+                } else {
+                    atomic_fetch_add(&ctx->cross_linked, 1);
+                    add_issue(ctx, FSCK_CROSS_LINKED, item->name, cluster);
+                }
+                return length;
+            }
+            length++;
+
+            uint16_t next = *(ctx->volume->fat + cluster);
+            if (next >= FAT_EOC)
+                break;
+            //free or bad cluster in the middle of a chain is treated the same way as a wild link
+            cluster = next;
+        }
+    }
+
+    if (!(item->attributes & ATTR_DIRECTORY)) {
+        uint32_t expected = (uint32_t) (((uint64_t) item->size + ctx->volume->bytes_per_cluster - 1) /
+                                        ctx->volume->bytes_per_cluster);
+        if (expected != length) {
+            atomic_fetch_add(&ctx->size_mismatches, 1);
+            add_issue(ctx, FSCK_SIZE_MISMATCH, item->name, item->first_cluster);
+        }
+    }
+
+    return length;
+}
+
+static void *check_worker(void *arg) {
+    struct fsck_ctx_t *ctx = arg;
+    uint32_t used = 0;
+
+    while (1) {
+        uint32_t idx = atomic_fetch_add(&ctx->next_item, 1);
+        if (idx >= ctx->items_count)
+            break;
+        used += check_chain(ctx, idx);
+    }
+
+    atomic_fetch_add(&ctx->clusters_used, used);
+    return NULL;
+}
+
+static int find_lost_chains(struct fsck_ctx_t *ctx) {
+    const uint16_t *fat = ctx->volume->fat;
+    struct fsck_report_t *report = ctx->report;
+
+    //1 - lost cluster, 2 - lost cluster pointed by another lost cluster, 3 - counted in some lost chain
+    uint8_t *lost = calloc(ctx->clusters_limit, sizeof(uint8_t));
+    if (lost == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (uint32_t i = FAT_FIRST_CLUSTER; i < ctx->clusters_limit; i++) {
+        if (fat[i] == FAT_FREE_CLUSTER || fat[i] == FAT_BAD_CLUSTER)
+            continue;
+        if (atomic_load_explicit(ctx->owners + i, memory_order_relaxed) != 0)
+            continue;
+        lost[i] = 1;
+        report->lost_clusters++;
+    }
+
+    for (uint32_t i = FAT_FIRST_CLUSTER; i < ctx->clusters_limit; i++) {
+        if (lost[i] && volume_cluster_in_range(ctx->volume, fat[i]) && lost[fat[i]])
+            lost[fat[i]] = 2;
+    }
+
+    //chains with a head first, then whatever is left are lost loops without any head
+    for (uint8_t pass = 1; pass <= 2; pass++) {
+        for (uint32_t i = FAT_FIRST_CLUSTER; i < ctx->clusters_limit; i++) {
+            if (lost[i] != pass)
+                continue;
+            report->lost_chains++;
+            add_issue(ctx, FSCK_LOST_CHAIN, "", i);
+
+            uint32_t cluster = i;
+            while (volume_cluster_in_range(ctx->volume, cluster) && (lost[cluster] == 1 || lost[cluster] == 2)) {
+                lost[cluster] = 3;
+                cluster = fat[cluster];
+            }
+        }
+    }
+
+    free(lost);
+    return 0;
+}
+
+//api
+
+int fat_check(struct volume_t *pvolume, uint32_t threads_count, struct fsck_report_t *report) {
+    if (pvolume == NULL || pvolume->fat == NULL || pvolume->disk == NULL || report == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    memset(report, 0, sizeof(struct fsck_report_t));
+
+    struct fsck_ctx_t ctx;
+    memset(&ctx, 0, sizeof(struct fsck_ctx_t));
+    ctx.volume = pvolume;
+    ctx.report = report;
+    ctx.clusters_limit = volume_clusters_limit(pvolume);
+
+    //root directory entries and (breadth first) entries of every reachable subdirectory
+    if (volume_walk(pvolume, add_item, &ctx) != 0) {
+        free(ctx.items);
+        return -1;
+    }
+
+    ctx.owners = calloc(ctx.clusters_limit, sizeof(atomic_uint_least32_t));
+    if (ctx.owners == NULL) {
+        free(ctx.items);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    run_workers(check_worker, &ctx, threads_count, ctx.items_count);
+
+    int res = find_lost_chains(&ctx);
+    free(ctx.owners);
+    free(ctx.items);
+    if (res != 0)
+        return -1;
+
+    report->entries_checked = ctx.items_count;
+    report->clusters_used = atomic_load(&ctx.clusters_used);
+    report->cross_linked = atomic_load(&ctx.cross_linked);
+    report->loops = atomic_load(&ctx.loops);
+    report->out_of_range = atomic_load(&ctx.out_of_range);
+    report->size_mismatches = atomic_load(&ctx.size_mismatches);
+    report->issues_count = atomic_load(&ctx.issues_count);
+
+    return report->issues_count == 0 ? 0 : 1;
+}
+
+const char *fsck_issue_name(uint8_t kind) {
+    switch (kind) {
+        case FSCK_CROSS_LINKED:
+            return "cross-linked";
+        case FSCK_LOOP:
+            return "loop";
+        case FSCK_OUT_OF_RANGE:
+            return "out of range";
+        case FSCK_SIZE_MISMATCH:
+            return "size mismatch";
+        case FSCK_LOST_CHAIN:
+            return "lost chain";
+        default:
+            return "unknown";
+    }
+}
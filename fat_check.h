@@ -0,0 +1,49 @@
+//
+// Created by root on 10/18/26.
+//
+
+#ifndef PROJEKT_FAT_FAT_CHECK_H
+#define PROJEKT_FAT_FAT_CHECK_H
+
+#include <stdint.h>
+
+#include "file_reader.h"
+
+#define FSCK_MAX_ISSUES             (64)
+
+enum fsck_issue_kind_t {
+    FSCK_CROSS_LINKED = 1, //cluster is owned by more than one chain
+    FSCK_LOOP, //chain comes back to one of its own clusters
+    FSCK_OUT_OF_RANGE, //first cluster or fat entry points outside of the data area
+    FSCK_SIZE_MISMATCH, //file size doesn't match the chain length
+    FSCK_LOST_CHAIN //allocated clusters not reachable from any directory entry
+};
+
+struct fsck_issue_t {
+    uint8_t kind; //enum fsck_issue_kind_t
+    char name[13]; //8.3 name of the entry (empty for lost chains)
+    uint16_t cluster; //cluster where the problem was found
+};
+
+struct fsck_report_t {
+    uint32_t entries_checked; //files and directories walked
+    uint32_t clusters_used; //clusters owned by some entry
+
+    uint32_t cross_linked; //chains running into a cluster owned by another entry
+    uint32_t loops; //chains that loop on themselves
+    uint32_t out_of_range; //chains with a first cluster or link outside of the data area
+    uint32_t size_mismatches; //files with size not matching chain length
+    uint32_t lost_clusters; //allocated but unreachable clusters
+    uint32_t lost_chains; //heads of unreachable chains
+
+    uint32_t issues_count; //all issues found (only FSCK_MAX_ISSUES are kept)
+    struct fsck_issue_t issues[FSCK_MAX_ISSUES];
+};
+
+//walks every directory entry of the volume and its cluster chain using threads_count workers
+//(0 = number of online cpus); returns 0 for clean volume, 1 if problems were found, -1 on error
+int fat_check(struct volume_t *pvolume, uint32_t threads_count, struct fsck_report_t *report);
+
+const char *fsck_issue_name(uint8_t kind);
+
+#endif //PROJEKT_FAT_FAT_CHECK_H
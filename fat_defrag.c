@@ -0,0 +1,38 @@
+//
+// Created by root on 10/18/26.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "file_reader.h"
+#include "fat_layout.h"
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <image> <output image>\n", argv[0]);
+        return 2;
+    }
+
+    struct disk_t *disk = disk_open_from_file(argv[1]);
+    if (disk == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+
+    struct volume_t *volume = fat_open(disk, 0);
+    if (volume == NULL) {
+        fprintf(stderr, "%s: not a valid FAT16 volume: %s\n", argv[1], strerror(errno));
+        disk_close(disk);
+        return 2;
+    }
+
+    int res = fat_defrag(volume, argv[2]);
+    if (res != 0)
+        fprintf(stderr, "%s: defragmentation failed: %s\n", argv[1], strerror(errno));
+
+    fat_close(volume);
+    disk_close(disk);
+    return res == 0 ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+//
+// Created by root on 10/18/26.
+//
+
+#include "fat_digest.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY                 (0x82F63B78) //reversed castagnoli polynomial
+
+//internal
+
+static uint32_t crc32c_table[8][256];
+static uint32_t (*crc32c_impl)(uint32_t crc, const uint8_t *p, size_t len);
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+//slicing-by-8, used when there is no crc32 instruction
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len > 0 && ((uintptr_t) p & 7)) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        len--;
+    }
+
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, sizeof(uint32_t));
+        memcpy(&hi, p + 4, sizeof(uint32_t));
+        lo ^= crc;
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+              crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len-- > 0)
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len > 0 && ((uintptr_t) p & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        len--;
+    }
+
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(uint64_t));
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t) crc64;
+
+    while (len-- > 0)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+static void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int slice = 1; slice < 8; slice++)
+            crc32c_table[slice][i] = crc32c_table[0][crc32c_table[slice - 1][i] & 0xFF] ^
+                                     (crc32c_table[slice - 1][i] >> 8);
+    }
+
+    crc32c_impl = crc32c_sw;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_impl = crc32c_sse42;
+#endif
+}
+
+struct hash_ctx_t {
+    const struct volume_t *volume;
+
+    struct file_hash_t *hashes;
+    uint16_t *first_clusters;
+    uint32_t count;
+    uint32_t capacity;
+    atomic_uint_least32_t next_file;
+};
+
+//streams the chain straight from disk into crc, runs of adjacent clusters are read with a single disk_read
+static int hash_file(const struct hash_ctx_t *ctx, uint32_t idx, char *buf, uint32_t buf_clusters) {
+    const struct volume_t *volume = ctx->volume;
+    struct file_hash_t *hash = ctx->hashes + idx;
+    uint32_t remaining = hash->size;
+    uint16_t cluster = *(ctx->first_clusters + idx);
+    uint32_t crc = 0;
+
+    while (remaining > 0) {
+        if (!volume_cluster_in_range(ctx->volume, cluster))
+            return ENXIO;
+
+        uint32_t needed = (remaining + volume->bytes_per_cluster - 1) / volume->bytes_per_cluster;
+        uint32_t run = 1;
+        while (run < buf_clusters && run < needed && volume_cluster_in_range(ctx->volume, cluster + run) &&
+               *(volume->fat + cluster + run - 1) == cluster + run)
+            run++;
+
+        uint32_t first_sector = (cluster - 2) * volume->sectors_per_cluster + volume->first_data_sector;
+        if (disk_read(volume->disk, first_sector, buf, run * volume->sectors_per_cluster) != 0)
+            return EIO;
+
+        uint32_t bytes = run * volume->bytes_per_cluster < remaining ? run * volume->bytes_per_cluster : remaining;
+        crc = crc32c(crc, buf, bytes);
+        remaining -= bytes;
+        cluster = *(volume->fat + cluster + run - 1);
+    }
+
+    hash->crc32c = crc;
+    return 0;
+}
+
+static int add_file(void *arg, const struct SFN *entry, const char *path) {
+    struct hash_ctx_t *ctx = arg;
+    if (entry->file_attributes & ATTR_DIRECTORY)
+        return 0;
+
+    if (ctx->count == ctx->capacity) {
+        uint32_t capacity = ctx->capacity == 0 ? 64 : ctx->capacity * 2;
+        struct file_hash_t *hashes = realloc(ctx->hashes, capacity * sizeof(struct file_hash_t));
+        if (hashes == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        ctx->hashes = hashes;
+        uint16_t *first_clusters = realloc(ctx->first_clusters, capacity * sizeof(uint16_t));
+        if (first_clusters == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        ctx->first_clusters = first_clusters;
+        ctx->capacity = capacity;
+    }
+
+    struct file_hash_t *hash = ctx->hashes + ctx->count;
+    memset(hash, 0, sizeof(struct file_hash_t));
+    strncpy(hash->path, path, HASH_PATH_MAX - 1);
+    hash->size = entry->size;
+    //file is still listed, but with a cut path it can't be told apart from others
+    if (strlen(path) >= HASH_PATH_MAX)
+        hash->error = ENAMETOOLONG;
+    *(ctx->first_clusters + ctx->count) = entry->low_order_address_of_first_cluster;
+    ctx->count++;
+    return 0;
+}
+
+static void *hash_worker(void *arg) {
+    struct hash_ctx_t *ctx = arg;
+    uint32_t buf_clusters = HASH_MAX_RUN_BYTES / ctx->volume->bytes_per_cluster;
+    if (buf_clusters == 0)
+        buf_clusters = 1;
+
+    char *buf = malloc(buf_clusters * ctx->volume->bytes_per_cluster);
+
+    while (1) {
+        uint32_t idx = atomic_fetch_add(&ctx->next_file, 1);
+        if (idx >= ctx->count)
+            break;
+        if ((ctx->hashes + idx)->error == 0)
+            (ctx->hashes + idx)->error = buf == NULL ? ENOMEM : hash_file(ctx, idx, buf, buf_clusters);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+//api
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    pthread_once(&crc32c_once, crc32c_init);
+    return ~crc32c_impl(~crc, (const uint8_t *) buf, len);
+}
+
+int fat_hash_files(struct volume_t *pvolume, uint32_t threads_count, struct file_hash_t **hashes, uint32_t *count) {
+    if (pvolume == NULL || pvolume->fat == NULL || pvolume->disk == NULL || hashes == NULL || count == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    struct hash_ctx_t ctx;
+    memset(&ctx, 0, sizeof(struct hash_ctx_t));
+    ctx.volume = pvolume;
+    if (volume_walk(pvolume, add_file, &ctx) != 0) {
+        free(ctx.hashes);
+        free(ctx.first_clusters);
+        return -1;
+    }
+
+    //tables have to be ready before workers start
+    pthread_once(&crc32c_once, crc32c_init);
+
+    run_workers(hash_worker, &ctx, threads_count, ctx.count);
+
+    free(ctx.first_clusters);
+    *hashes = ctx.hashes;
+    *count = ctx.count;
+    return 0;
+}
+
+int fat_hash_write_manifest(FILE *out, const struct file_hash_t *hashes, uint32_t count) {
+    if (out == NULL || (hashes == NULL && count > 0)) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        const struct file_hash_t *hash = hashes + i;
+        int res = hash->error == 0 ?
+                  fprintf(out, "%08x %10u %s\n", hash->crc32c, hash->size, hash->path) :
+                  fprintf(out, "%-8s %10u %s\n", "error", hash->size, hash->path);
+        if (res < 0) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    return 0;
+}
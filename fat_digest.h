@@ -0,0 +1,35 @@
+//
+// Created by root on 10/18/26.
+//
+
+#ifndef PROJEKT_FAT_FAT_DIGEST_H
+#define PROJEKT_FAT_FAT_DIGEST_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_reader.h"
+
+#define HASH_MAX_RUN_BYTES          (256 * 1024) //max bytes read from disk at once by a single worker
+#define HASH_PATH_MAX               (260) //longer paths are cut and their files get ENAMETOOLONG
+
+struct file_hash_t {
+    char path[HASH_PATH_MAX]; //8.3 names joined with '\\', relative to the root directory
+    uint32_t size;
+    uint32_t crc32c;
+    int error; //0 when crc32c is valid, errno value otherwise
+};
+
+//crc32c (castagnoli) of buf continuing from crc (0 for the first block), uses sse4.2 when cpu has it
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+//hashes every file of the root directory and of all its subdirectories using threads_count workers
+//(0 = number of online cpus); *hashes gets a malloc'ed array in directory listing order, breadth first;
+//returns 0 on success, -1 on error
+int fat_hash_files(struct volume_t *pvolume, uint32_t threads_count, struct file_hash_t **hashes, uint32_t *count);
+
+//writes "<crc32c> <size> <path>" line for every file; returns 0 on success, -1 on error
+int fat_hash_write_manifest(FILE *out, const struct file_hash_t *hashes, uint32_t count);
+
+#endif //PROJEKT_FAT_FAT_DIGEST_H
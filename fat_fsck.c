@@ -0,0 +1,63 @@
+//
+// Created by root on 10/18/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "file_reader.h"
+#include "fat_check.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image> [threads]\n", argv[0]);
+        return 2;
+    }
+    uint32_t threads = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 0;
+
+    struct disk_t *disk = disk_open_from_file(argv[1]);
+    if (disk == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+
+    struct volume_t *volume = fat_open(disk, 0);
+    if (volume == NULL) {
+        fprintf(stderr, "%s: not a valid FAT16 volume: %s\n", argv[1], strerror(errno));
+        disk_close(disk);
+        return 2;
+    }
+
+    struct fsck_report_t report;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int res = fat_check(volume, threads, &report);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (res == -1) {
+        fprintf(stderr, "%s: check failed: %s\n", argv[1], strerror(errno));
+        fat_close(volume);
+        disk_close(disk);
+        return 2;
+    }
+
+    for (uint32_t i = 0; i < report.issues_count && i < FSCK_MAX_ISSUES; i++) {
+        printf("%s: %s at cluster %u\n", report.issues[i].name[0] ? report.issues[i].name : "-",
+               fsck_issue_name(report.issues[i].kind), report.issues[i].cluster);
+    }
+    if (report.issues_count > FSCK_MAX_ISSUES)
+        printf("... %u more issues\n", report.issues_count - FSCK_MAX_ISSUES);
+
+    printf("%u entries, %u/%u clusters used, %u cross-linked, %u loops, %u out of range, "
+           "%u size mismatches, %u lost clusters in %u chains (%.3f ms)\n",
+           report.entries_checked, report.clusters_used, volume->clusters_count, report.cross_linked,
+           report.loops, report.out_of_range, report.size_mismatches, report.lost_clusters, report.lost_chains,
+           (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    fat_close(volume);
+    disk_close(disk);
+    return res;
+}
@@ -0,0 +1,52 @@
+//
+// Created by root on 10/18/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "file_reader.h"
+#include "fat_digest.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <image> [threads]\n", argv[0]);
+        return 2;
+    }
+    uint32_t threads = argc > 2 ? (uint32_t) strtoul(argv[2], NULL, 10) : 0;
+
+    struct disk_t *disk = disk_open_from_file(argv[1]);
+    if (disk == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+
+    struct volume_t *volume = fat_open(disk, 0);
+    if (volume == NULL) {
+        fprintf(stderr, "%s: not a valid FAT16 volume: %s\n", argv[1], strerror(errno));
+        disk_close(disk);
+        return 2;
+    }
+
+    struct file_hash_t *hashes;
+    uint32_t count;
+    int res = fat_hash_files(volume, threads, &hashes, &count);
+    if (res == 0) {
+        res = fat_hash_write_manifest(stdout, hashes, count);
+        for (uint32_t i = 0; i < count; i++) {
+            if (hashes[i].error != 0) {
+                fprintf(stderr, "%s: %s\n", hashes[i].path, strerror(hashes[i].error));
+                res = 1;
+            }
+        }
+        free(hashes);
+    } else {
+        fprintf(stderr, "%s: hashing failed: %s\n", argv[1], strerror(errno));
+    }
+
+    fat_close(volume);
+    disk_close(disk);
+    return res == 0 ? 0 : 1;
+}
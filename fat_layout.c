@@ -0,0 +1,355 @@
+//
+// Created by root on 10/18/26.
+//
+
+#include "fat_layout.h"
+#include "fat_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DIR_CLUSTER                 (1)
+#define DIR_FIRST_CLUSTER           (2)
+
+//internal
+
+struct defrag_ctx_t {
+    const struct volume_t *volume;
+    uint32_t clusters_limit; //first cluster number past the data area
+
+    uint16_t *new_of; //old cluster -> new cluster
+    uint16_t *old_of; //new cluster -> old cluster (0 for unused)
+    uint8_t *dir_clusters; //new cluster -> DIR_CLUSTER/DIR_FIRST_CLUSTER for directory clusters
+    uint16_t *new_fat;
+    uint32_t next_cluster; //next free cluster of the new layout
+};
+
+static int plan_dir(struct defrag_ctx_t *ctx, uint16_t first_cluster);
+
+static uint16_t take_cluster(struct defrag_ctx_t *ctx) {
+    //bad clusters stay where they are
+    while (ctx->next_cluster < ctx->clusters_limit && *(ctx->volume->fat + ctx->next_cluster) == FAT_BAD_CLUSTER) {
+        *(ctx->new_fat + ctx->next_cluster) = FAT_BAD_CLUSTER;
+        ctx->next_cluster++;
+    }
+    if (ctx->next_cluster >= ctx->clusters_limit)
+        return 0;
+    return ctx->next_cluster++;
+}
+
+static int assign_chain(struct defrag_ctx_t *ctx, uint16_t first_cluster, int is_dir) {
+    uint16_t cluster = first_cluster, prev = 0;
+
+    while (1) {
+        uint16_t new_cluster = take_cluster(ctx);
+        if (new_cluster == 0) {
+            errno = ENOSPC;
+            return -1;
+        }
+
+        *(ctx->new_of + cluster) = new_cluster;
+        *(ctx->old_of + new_cluster) = cluster;
+        if (is_dir)
+            *(ctx->dir_clusters + new_cluster) = prev == 0 ? DIR_FIRST_CLUSTER : DIR_CLUSTER;
+        if (prev != 0)
+            *(ctx->new_fat + prev) = new_cluster;
+        prev = new_cluster;
+
+        uint16_t next = *(ctx->volume->fat + cluster);
+        if (next >= FAT_EOC)
+            break;
+        cluster = next;
+    }
+
+    *(ctx->new_fat + prev) = 0xFFFF;
+    return 0;
+}
+
+//returns 1 when end of directory was reached, 0 when more entries may follow, -1 on error
+static int plan_entries(struct defrag_ctx_t *ctx, const struct SFN *entries, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        const struct SFN *entry = entries + i;
+        uint8_t first = *((const uint8_t *) entry->filename);
+        if (first == DIR_EOF)
+            return 1;
+        if (first == DIR_FREE || first == '.' || entry->file_attributes == ATTR_LONG_NAME)
+            continue;
+        if (entry->low_order_address_of_first_cluster == FAT_FREE_CLUSTER)
+            continue;
+
+        int is_dir = entry->file_attributes & ATTR_DIRECTORY ? 1 : 0;
+        if (assign_chain(ctx, entry->low_order_address_of_first_cluster, is_dir) != 0)
+            return -1;
+        //contents of subdirectory go right after it
+        if (is_dir && plan_dir(ctx, entry->low_order_address_of_first_cluster) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int plan_dir(struct defrag_ctx_t *ctx, uint16_t first_cluster) {
+    const struct volume_t *volume = ctx->volume;
+    struct SFN *buf = malloc(volume->bytes_per_cluster);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    uint16_t cluster = first_cluster;
+    while (1) {
+        uint32_t first_sector = (cluster - 2) * volume->sectors_per_cluster + volume->first_data_sector;
+        if (disk_read(volume->disk, first_sector, buf, volume->sectors_per_cluster) != 0) {
+            free(buf);
+            errno = EIO;
+            return -1;
+        }
+
+        int res = plan_entries(ctx, buf, volume->bytes_per_cluster / sizeof(struct SFN));
+        if (res == -1) {
+            free(buf);
+            return -1;
+        }
+
+        uint16_t next = *(volume->fat + cluster);
+        if (res == 1 || next >= FAT_EOC)
+            break;
+        cluster = next;
+    }
+
+    free(buf);
+    return 0;
+}
+
+//rewrites first clusters of directory entries to the new layout; returns 1 when end of directory was reached
+static int patch_entries(const struct defrag_ctx_t *ctx, struct SFN *entries, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        struct SFN *entry = entries + i;
+        uint8_t first = *((uint8_t *) entry->filename);
+        if (first == DIR_EOF)
+            return 1;
+        if (first == DIR_FREE || entry->file_attributes == ATTR_LONG_NAME)
+            continue;
+
+        uint16_t cluster = entry->low_order_address_of_first_cluster;
+        if (volume_cluster_in_range(ctx->volume, cluster))
+            entry->low_order_address_of_first_cluster = *(ctx->new_of + cluster);
+    }
+    return 0;
+}
+
+static int write_zeros(FILE *out, void *buf, uint32_t buf_size, uint64_t bytes) {
+    memset(buf, 0, buf_size);
+    while (bytes > 0) {
+        uint32_t chunk = bytes < buf_size ? (uint32_t) bytes : buf_size;
+        if (fwrite(buf, 1, chunk, out) != chunk)
+            return -1;
+        bytes -= chunk;
+    }
+    return 0;
+}
+
+static int write_image(const struct defrag_ctx_t *ctx, FILE *out) {
+    const struct volume_t *volume = ctx->volume;
+    const uint32_t buf_size = DEFRAG_MAX_RUN_CLUSTERS * volume->bytes_per_cluster;
+    char *buf = malloc(buf_size);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    //boot and reserved sectors stay the same
+    for (uint32_t i = 0; i < volume->boot_sectors_count; i++) {
+        if (disk_read(volume->disk, i, buf, 1) != 0 || fwrite(buf, SECTOR_SIZE, 1, out) != 1)
+            goto err_ret;
+    }
+
+    //every copy of fat gets the same new table
+    uint32_t fat_bytes = volume->fat_sectors_count / volume->fats_count * SECTOR_SIZE;
+    for (uint8_t i = 0; i < volume->fats_count; i++) {
+        if (fwrite(ctx->new_fat, 1, fat_bytes, out) != fat_bytes)
+            goto err_ret;
+    }
+
+    struct SFN *root_dir = read_root_dir(volume);
+    if (root_dir == NULL)
+        goto err_ret;
+    patch_entries(ctx, root_dir, volume->root_entries_count);
+    if (fwrite(root_dir, SECTOR_SIZE, volume->root_sectors_count, out) != volume->root_sectors_count) {
+        free(root_dir);
+        goto err_ret;
+    }
+    free(root_dir);
+
+    //data area is written strictly sequentially, reads are coalesced into runs of old clusters
+    int dir_eof = 0;
+    uint32_t cluster = FAT_FIRST_CLUSTER;
+    while (cluster < ctx->clusters_limit) {
+        uint16_t old_cluster = *(ctx->old_of + cluster);
+        uint32_t run = 1;
+
+        if (old_cluster == 0) {
+            while (cluster + run < ctx->clusters_limit && run < DEFRAG_MAX_RUN_CLUSTERS &&
+                   *(ctx->old_of + cluster + run) == 0)
+                run++;
+            memset(buf, 0, run * volume->bytes_per_cluster);
+        } else {
+            while (cluster + run < ctx->clusters_limit && run < DEFRAG_MAX_RUN_CLUSTERS &&
+                   *(ctx->old_of + cluster + run) == old_cluster + run)
+                run++;
+            uint32_t first_sector = (old_cluster - 2) * volume->sectors_per_cluster + volume->first_data_sector;
+            if (disk_read(volume->disk, first_sector, buf, run * volume->sectors_per_cluster) != 0)
+                goto err_ret;
+
+            for (uint32_t i = 0; i < run; i++) {
+                uint8_t dir_cluster = *(ctx->dir_clusters + cluster + i);
+                if (dir_cluster == DIR_FIRST_CLUSTER)
+                    dir_eof = 0;
+                if (dir_cluster && !dir_eof)
+                    dir_eof = patch_entries(ctx, (struct SFN *) (buf + i * volume->bytes_per_cluster),
+                                            volume->bytes_per_cluster / sizeof(struct SFN));
+            }
+        }
+
+        if (fwrite(buf, volume->bytes_per_cluster, run, out) != run)
+            goto err_ret;
+        cluster += run;
+    }
+
+    //whatever is left after the last cluster (and after the volume) is zeroed
+    uint64_t written = volume->first_data_sector + (uint64_t) (ctx->clusters_limit - 2) * volume->sectors_per_cluster;
+    if (written < volume->disk->sectors_count &&
+        write_zeros(out, buf, buf_size, (volume->disk->sectors_count - written) * SECTOR_SIZE) != 0)
+        goto err_ret;
+
+    free(buf);
+    return 0;
+
+    err_ret:
+    free(buf);
+    if (errno == 0)
+        errno = EIO;
+    return -1;
+}
+
+//api
+
+int fat_defrag(struct volume_t *pvolume, const char *output_file_name) {
+    if (pvolume == NULL || pvolume->fat == NULL || pvolume->disk == NULL || output_file_name == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    //output is written while the source is still being read, so they can't be the same file
+    struct stat disk_stat, output_stat;
+    if (fstat(fileno(pvolume->disk->file), &disk_stat) == 0 && stat(output_file_name, &output_stat) == 0 &&
+        disk_stat.st_dev == output_stat.st_dev && disk_stat.st_ino == output_stat.st_ino) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    //chains are followed blindly from here on, so only a consistent volume is accepted
+    struct fsck_report_t *report = malloc(sizeof(struct fsck_report_t));
+    if (report == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (fat_check(pvolume, 0, report) == -1) {
+        free(report);
+        return -1;
+    }
+    if (report->cross_linked || report->loops || report->out_of_range || report->size_mismatches) {
+        free(report);
+        errno = EINVAL;
+        return -1;
+    }
+    free(report);
+
+    struct defrag_ctx_t ctx;
+    memset(&ctx, 0, sizeof(struct defrag_ctx_t));
+    ctx.volume = pvolume;
+    ctx.clusters_limit = volume_clusters_limit(pvolume);
+    ctx.next_cluster = FAT_FIRST_CLUSTER;
+    ctx.new_of = calloc(ctx.clusters_limit, sizeof(uint16_t));
+    ctx.old_of = calloc(ctx.clusters_limit, sizeof(uint16_t));
+    ctx.dir_clusters = calloc(ctx.clusters_limit, sizeof(uint8_t));
+    ctx.new_fat = calloc(pvolume->fat_size, sizeof(uint16_t));
+
+    int res = -1;
+    FILE *out = NULL;
+    char *temp_name = NULL;
+    if (ctx.new_of == NULL || ctx.old_of == NULL || ctx.dir_clusters == NULL || ctx.new_fat == NULL) {
+        errno = ENOMEM;
+        goto cleanup;
+    }
+
+    //reserved entries and whatever lies past the data area are kept as they are
+    memcpy(ctx.new_fat, pvolume->fat, FAT_FIRST_CLUSTER * sizeof(uint16_t));
+    memcpy(ctx.new_fat + ctx.clusters_limit, pvolume->fat + ctx.clusters_limit,
+           (pvolume->fat_size - ctx.clusters_limit) * sizeof(uint16_t));
+
+    struct SFN *root_dir = read_root_dir(pvolume);
+    if (root_dir == NULL)
+        goto cleanup;
+    int planned = plan_entries(&ctx, root_dir, pvolume->root_entries_count);
+    free(root_dir);
+    if (planned == -1)
+        goto cleanup;
+
+    for (uint32_t i = ctx.next_cluster; i < ctx.clusters_limit; i++) {
+        if (*(pvolume->fat + i) == FAT_BAD_CLUSTER)
+            *(ctx.new_fat + i) = FAT_BAD_CLUSTER;
+    }
+
+    //image goes to a temporary file next to the output, which is replaced only when everything was written
+    temp_name = malloc(strlen(output_file_name) + sizeof(".XXXXXX"));
+    if (temp_name == NULL) {
+        errno = ENOMEM;
+        goto cleanup;
+    }
+    strcpy(temp_name, output_file_name);
+    strcat(temp_name, ".XXXXXX");
+    int fd = mkstemp(temp_name);
+    if (fd == -1) {
+        free(temp_name);
+        temp_name = NULL;
+        goto cleanup;
+    }
+    //mkstemp creates the file with 0600, output gets the same mode fopen would give it
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+    out = fdopen(fd, "wb");
+    if (out == NULL) {
+        close(fd);
+        goto cleanup;
+    }
+
+    errno = 0;
+    res = write_image(&ctx, out);
+
+    cleanup:
+    if (out != NULL && fclose(out) != 0 && res == 0) {
+        errno = EIO;
+        res = -1;
+    }
+    if (temp_name != NULL) {
+        if (res == 0 && rename(temp_name, output_file_name) != 0)
+            res = -1;
+        if (res != 0) {
+            int saved_errno = errno;
+            unlink(temp_name);
+            errno = saved_errno;
+        }
+        free(temp_name);
+    }
+    free(ctx.new_of);
+    free(ctx.old_of);
+    free(ctx.dir_clusters);
+    free(ctx.new_fat);
+    return res;
+}
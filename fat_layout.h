@@ -0,0 +1,19 @@
+//
+// Created by root on 10/18/26.
+//
+
+#ifndef PROJEKT_FAT_FAT_LAYOUT_H
+#define PROJEKT_FAT_FAT_LAYOUT_H
+
+#include "file_reader.h"
+
+#define DEFRAG_MAX_RUN_CLUSTERS     (32) //max clusters copied with a single read
+
+//writes a copy of the volume to output_file_name with every chain stored contiguously,
+//in directory listing order (subdirectory contents follow the subdirectory itself);
+//volume has to pass fat_check, lost chains are dropped; output is written to a temporary file that replaces
+//output_file_name only on success, output can't be the volume's own image (EINVAL);
+//returns 0 on success, -1 on error
+int fat_defrag(struct volume_t *pvolume, const char *output_file_name);
+
+#endif //PROJEKT_FAT_FAT_LAYOUT_H
@@ -0,0 +1,381 @@
+//
+// Created by root on 10/18/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "file_reader.h"
+#include "fat_trace.h"
+
+#define OPS_COUNT                   (TRACE_FILE_CLOSE + 1)
+
+struct replay_op_t {
+    struct trace_record_t record;
+    char *name; //file name for TRACE_FILE_OPEN
+};
+
+struct replay_t {
+    struct volume_t *volume;
+
+    struct replay_op_t *ops;
+    uint32_t ops_count;
+    uint32_t skipped; //ops on handles that were opened before the trace started
+    uint32_t *latencies; //ns, per op
+
+    //ops grouped by handle, group 0 holds disk reads and failed opens
+    uint32_t *group_ops; //op indices ordered by group
+    uint32_t *group_start; //groups_count + 1 entries
+    uint32_t groups_count;
+    atomic_uint_least32_t next_group;
+
+    struct file_t **files; //indexed by handle
+    atomic_uint_least64_t bytes;
+    atomic_uint_least32_t errors;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int load_trace(const char *path, struct replay_t *replay) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return -1;
+
+    char magic[TRACE_MAGIC_LEN];
+    if (fread(magic, 1, TRACE_MAGIC_LEN, f) != TRACE_MAGIC_LEN || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0) {
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t capacity = 0;
+    struct trace_record_t record;
+    while (fread(&record, sizeof(struct trace_record_t), 1, f) == 1) {
+        char *name = NULL;
+        if (record.op == TRACE_FILE_OPEN) {
+            if (record.arg0 < 0 || (name = calloc(record.arg0 + 1, sizeof(char))) == NULL ||
+                fread(name, 1, record.arg0, f) != (size_t) record.arg0) {
+                errno = record.arg0 >= 0 && name == NULL ? ENOMEM : EINVAL;
+                free(name);
+                fclose(f);
+                return -1;
+            }
+        }
+        //operations issued by other traced operations are replayed by them
+        if (record.flags & TRACE_NESTED || record.op == 0 || record.op >= OPS_COUNT) {
+            free(name);
+            continue;
+        }
+
+        if (replay->ops_count == capacity) {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            struct replay_op_t *new_ops = realloc(replay->ops, capacity * sizeof(struct replay_op_t));
+            if (new_ops == NULL) {
+                free(name);
+                fclose(f);
+                errno = ENOMEM;
+                return -1;
+            }
+            replay->ops = new_ops;
+        }
+        replay->ops[replay->ops_count].record = record;
+        replay->ops[replay->ops_count].name = name;
+        replay->ops_count++;
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+//handle ids come straight from the trace file, they are replaced with dense ids (1..distinct handles)
+//before being used as array indices; 0 stays 0
+static int remap_handles(struct replay_t *replay) {
+    uint32_t *ids = malloc((replay->ops_count > 0 ? replay->ops_count : 1) * sizeof(uint32_t));
+    if (ids == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < replay->ops_count; i++) {
+        if (replay->ops[i].record.handle != 0)
+            ids[count++] = replay->ops[i].record.handle;
+    }
+    qsort(ids, count, sizeof(uint32_t), compare_u32);
+    uint32_t distinct = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (distinct == 0 || ids[distinct - 1] != ids[i])
+            ids[distinct++] = ids[i];
+    }
+
+    for (uint32_t i = 0; i < replay->ops_count; i++) {
+        uint32_t handle = replay->ops[i].record.handle;
+        if (handle != 0)
+            replay->ops[i].record.handle =
+                    (uint32_t *) bsearch(&handle, ids, distinct, sizeof(uint32_t), compare_u32) - ids + 1;
+    }
+
+    free(ids);
+    return 0;
+}
+
+//handle has to be opened inside of the trace to be replayed, ops on other handles are only counted
+static int drop_unopened(struct replay_t *replay) {
+    uint32_t max_handle = 0;
+    for (uint32_t i = 0; i < replay->ops_count; i++) {
+        if (replay->ops[i].record.handle > max_handle)
+            max_handle = replay->ops[i].record.handle;
+    }
+
+    uint8_t *opened = calloc(max_handle + 1, sizeof(uint8_t));
+    if (opened == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (uint32_t i = 0; i < replay->ops_count; i++) {
+        if (replay->ops[i].record.op == TRACE_FILE_OPEN && replay->ops[i].record.handle != 0)
+            opened[replay->ops[i].record.handle] = 1;
+    }
+
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < replay->ops_count; i++) {
+        const struct trace_record_t *record = &replay->ops[i].record;
+        if (record->op == TRACE_DISK_READ || record->op == TRACE_FILE_OPEN || opened[record->handle])
+            replay->ops[kept++] = replay->ops[i];
+        else
+            replay->skipped++;
+    }
+    replay->ops_count = kept;
+
+    free(opened);
+    return 0;
+}
+
+static int group_ops(struct replay_t *replay) {
+    uint32_t max_handle = 0;
+    for (uint32_t i = 0; i < replay->ops_count; i++) {
+        if (replay->ops[i].record.handle > max_handle)
+            max_handle = replay->ops[i].record.handle;
+    }
+
+    replay->groups_count = max_handle + 1;
+    replay->group_start = calloc(replay->groups_count + 1, sizeof(uint32_t));
+    replay->group_ops = calloc(replay->ops_count > 0 ? replay->ops_count : 1, sizeof(uint32_t));
+    replay->files = calloc(replay->groups_count, sizeof(struct file_t *));
+    replay->latencies = calloc(replay->ops_count > 0 ? replay->ops_count : 1, sizeof(uint32_t));
+    if (replay->group_start == NULL || replay->group_ops == NULL || replay->files == NULL ||
+        replay->latencies == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    //counting sort keeps trace order inside of every group
+    for (uint32_t i = 0; i < replay->ops_count; i++)
+        replay->group_start[replay->ops[i].record.handle + 1]++;
+    for (uint32_t i = 0; i < replay->groups_count; i++)
+        replay->group_start[i + 1] += replay->group_start[i];
+
+    uint32_t *fill = calloc(replay->groups_count, sizeof(uint32_t));
+    if (fill == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (uint32_t i = 0; i < replay->ops_count; i++) {
+        uint32_t handle = replay->ops[i].record.handle;
+        replay->group_ops[replay->group_start[handle] + fill[handle]++] = i;
+    }
+    free(fill);
+    return 0;
+}
+
+static void run_op(struct replay_t *replay, uint32_t idx, char **buf, size_t *buf_size) {
+    const struct trace_record_t *record = &replay->ops[idx].record;
+    struct file_t **file = replay->files + record->handle;
+
+    size_t needed = 0;
+    if (record->op == TRACE_DISK_READ && record->arg1 > 0)
+        needed = (size_t) record->arg1 * SECTOR_SIZE;
+    else if (record->op == TRACE_FILE_READ && record->arg0 > 0 && record->arg1 > 0)
+        needed = (size_t) record->arg0 * record->arg1;
+    if (needed > *buf_size) {
+        char *new_buf = realloc(*buf, needed);
+        if (new_buf == NULL) {
+            atomic_fetch_add(&replay->errors, 1);
+            return;
+        }
+        *buf = new_buf;
+        *buf_size = needed;
+    }
+
+    uint64_t start = now_ns();
+    switch (record->op) {
+        case TRACE_DISK_READ: {
+            if (disk_read(replay->volume->disk, record->arg0, *buf, record->arg1) == 0)
+                atomic_fetch_add(&replay->bytes, (uint64_t) record->arg1 * SECTOR_SIZE);
+            else if (record->result == 0)
+                atomic_fetch_add(&replay->errors, 1);
+        }
+            break;
+        case TRACE_FILE_OPEN: {
+            struct file_t *opened = file_open(replay->volume, replay->ops[idx].name);
+            if (record->handle == 0) {
+                //failed in production, only its cost is of interest
+                if (opened != NULL)
+                    file_close(opened);
+            } else if (opened == NULL) {
+                atomic_fetch_add(&replay->errors, 1);
+            } else {
+                *file = opened;
+            }
+        }
+            break;
+        case TRACE_FILE_READ: {
+            if (*file == NULL)
+                break;
+            size_t res = file_read(*buf, record->arg0, record->arg1, *file);
+            if (res != (size_t) -1)
+                atomic_fetch_add(&replay->bytes, (uint64_t) res * record->arg0);
+            else if (record->result != -1)
+                atomic_fetch_add(&replay->errors, 1);
+        }
+            break;
+        case TRACE_FILE_SEEK: {
+            if (*file != NULL && file_seek(*file, record->arg0, record->arg1) != record->result)
+                atomic_fetch_add(&replay->errors, 1);
+        }
+            break;
+        case TRACE_FILE_CLOSE: {
+            if (*file != NULL)
+                file_close(*file);
+            *file = NULL;
+        }
+            break;
+    }
+    uint64_t elapsed = now_ns() - start;
+    replay->latencies[idx] = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t) elapsed;
+}
+
+static void *replay_worker(void *arg) {
+    struct replay_t *replay = arg;
+    char *buf = NULL;
+    size_t buf_size = 0;
+
+    while (1) {
+        uint32_t group = atomic_fetch_add(&replay->next_group, 1);
+        if (group >= replay->groups_count)
+            break;
+        for (uint32_t i = replay->group_start[group]; i < replay->group_start[group + 1]; i++)
+            run_op(replay, replay->group_ops[i], &buf, &buf_size);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void print_latencies(const struct replay_t *replay) {
+    static const char *names[OPS_COUNT] = {NULL, "disk_read", "file_open", "file_read", "file_seek", "file_close"};
+
+    uint32_t *values = malloc((replay->ops_count > 0 ? replay->ops_count : 1) * sizeof(uint32_t));
+    if (values == NULL)
+        return;
+
+    printf("%-10s %9s %10s %10s %10s %10s %10s (us)\n", "op", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (uint8_t op = TRACE_DISK_READ; op < OPS_COUNT; op++) {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < replay->ops_count; i++) {
+            if (replay->ops[i].record.op == op)
+                values[count++] = replay->latencies[i];
+        }
+        if (count == 0)
+            continue;
+
+        qsort(values, count, sizeof(uint32_t), compare_u32);
+        printf("%-10s %9u %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[op], count,
+               values[(uint64_t) count * 50 / 100] / 1e3, values[(uint64_t) count * 90 / 100] / 1e3,
+               values[(uint64_t) count * 99 / 100] / 1e3, values[(uint64_t) count * 999 / 1000] / 1e3,
+               values[count - 1] / 1e3);
+    }
+    free(values);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <trace> <image> [threads]\n", argv[0]);
+        return 2;
+    }
+    uint32_t threads_count = argc > 3 ? (uint32_t) strtoul(argv[3], NULL, 10) : 1;
+    if (threads_count == 0)
+        threads_count = 1;
+
+    struct replay_t replay;
+    memset(&replay, 0, sizeof(struct replay_t));
+    if (load_trace(argv[1], &replay) != 0 || remap_handles(&replay) != 0 || drop_unopened(&replay) != 0 ||
+        group_ops(&replay) != 0) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 2;
+    }
+
+    struct disk_t *disk = disk_open_from_file(argv[2]);
+    if (disk == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+        return 2;
+    }
+    replay.volume = fat_open(disk, 0);
+    if (replay.volume == NULL) {
+        fprintf(stderr, "%s: not a valid FAT16 volume: %s\n", argv[2], strerror(errno));
+        disk_close(disk);
+        return 2;
+    }
+
+    uint64_t start = now_ns();
+    if (threads_count == 1) {
+        //single thread keeps the original interleaving of all handles
+        char *buf = NULL;
+        size_t buf_size = 0;
+        for (uint32_t i = 0; i < replay.ops_count; i++)
+            run_op(&replay, i, &buf, &buf_size);
+        free(buf);
+    } else {
+        //every handle is replayed in order by one thread, handles are spread over threads
+        run_workers(replay_worker, &replay, threads_count, replay.groups_count);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    for (uint32_t i = 0; i < replay.groups_count; i++) {
+        if (replay.files[i] != NULL)
+            file_close(replay.files[i]);
+    }
+
+    double seconds = elapsed / 1e9;
+    printf("replayed %u ops on %u threads in %.3f ms, %.1f ops/s, %.1f MiB/s, %u errors\n",
+           replay.ops_count, threads_count, elapsed / 1e6, seconds > 0 ? replay.ops_count / seconds : 0,
+           seconds > 0 ? atomic_load(&replay.bytes) / seconds / (1024 * 1024) : 0, atomic_load(&replay.errors));
+    if (replay.skipped > 0)
+        printf("skipped %u ops on handles opened before the trace started\n", replay.skipped);
+    print_latencies(&replay);
+
+    for (uint32_t i = 0; i < replay.ops_count; i++)
+        free(replay.ops[i].name);
+    free(replay.ops);
+    free(replay.latencies);
+    free(replay.group_ops);
+    free(replay.group_start);
+    free(replay.files);
+    fat_close(replay.volume);
+    disk_close(disk);
+    return 0;
+}
@@ -0,0 +1,131 @@
+//
+// Created by root on 10/18/26.
+//
+
+#include "fat_trace.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+//internal
+
+static atomic_int trace_enabled;
+static FILE *trace_file; //guarded by trace_lock
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t trace_origin; //guarded by trace_lock
+
+static atomic_uint_least32_t next_handle;
+static atomic_uint_least16_t next_thread;
+static _Thread_local uint16_t thread_id;
+static _Thread_local uint32_t trace_depth; //traced operations currently running on this thread
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+//api
+
+int fat_trace_start(const char *trace_file_name) {
+    if (trace_file_name == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file != NULL) {
+        pthread_mutex_unlock(&trace_lock);
+        errno = EBUSY;
+        return -1;
+    }
+
+    FILE *f = fopen(trace_file_name, "wb");
+    if (f == NULL) {
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    if (fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, f) != TRACE_MAGIC_LEN) {
+        fclose(f);
+        pthread_mutex_unlock(&trace_lock);
+        errno = EIO;
+        return -1;
+    }
+
+    trace_file = f;
+    trace_origin = now_ns();
+    atomic_store(&trace_enabled, 1);
+    pthread_mutex_unlock(&trace_lock);
+    return 0;
+}
+
+int fat_trace_stop(void) {
+    atomic_store(&trace_enabled, 0);
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_file == NULL) {
+        pthread_mutex_unlock(&trace_lock);
+        errno = EINVAL;
+        return -1;
+    }
+    int res = fclose(trace_file);
+    trace_file = NULL;
+    pthread_mutex_unlock(&trace_lock);
+
+    if (res != 0) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t trace_enter(void) {
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+        return 0;
+    trace_depth++;
+    return now_ns();
+}
+
+void trace_leave(uint64_t start, uint8_t op, uint32_t handle, int32_t arg0, int32_t arg1, int32_t result,
+                 const char *name) {
+    if (start == 0)
+        return;
+    trace_depth--;
+
+    int saved_errno = errno;
+    uint64_t end = now_ns();
+
+    if (thread_id == 0)
+        thread_id = atomic_fetch_add(&next_thread, 1) + 1;
+
+    struct trace_record_t record;
+    record.duration_ns = end - start > UINT32_MAX ? UINT32_MAX : (uint32_t) (end - start);
+    record.handle = handle;
+    record.arg0 = arg0;
+    record.arg1 = arg1;
+    record.result = result;
+    record.op = op;
+    record.flags = trace_depth > 0 ? TRACE_NESTED : 0;
+    record.thread = thread_id;
+
+    pthread_mutex_lock(&trace_lock);
+    //trace could have been stopped (or restarted) while the operation was running
+    if (trace_file != NULL && start >= trace_origin) {
+        record.timestamp_ns = start - trace_origin;
+        fwrite(&record, sizeof(struct trace_record_t), 1, trace_file);
+        if (op == TRACE_FILE_OPEN && arg0 > 0)
+            fwrite(name, 1, arg0, trace_file);
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    errno = saved_errno;
+}
+
+uint32_t trace_next_handle(void) {
+    return atomic_fetch_add(&next_handle, 1) + 1;
+}
@@ -0,0 +1,48 @@
+//
+// Created by root on 10/18/26.
+//
+
+#ifndef PROJEKT_FAT_FAT_TRACE_H
+#define PROJEKT_FAT_FAT_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC                 "FATTRC01"
+#define TRACE_MAGIC_LEN             (8)
+
+#define TRACE_NESTED                (1) //record flag: operation issued from inside of another traced operation
+
+enum trace_op_t {
+    TRACE_DISK_READ = 1, //arg0 - first sector, arg1 - sectors count, result - disk_read result
+    TRACE_FILE_OPEN, //arg0 - name length (name bytes follow the record), result - 0 or errno
+    TRACE_FILE_READ, //arg0 - size, arg1 - nmemb, result - file_read result
+    TRACE_FILE_SEEK, //arg0 - offset, arg1 - whence, result - file_seek result
+    TRACE_FILE_CLOSE //result - file_close result
+};
+
+//trace file is TRACE_MAGIC followed by these records
+struct trace_record_t {
+    uint64_t timestamp_ns; //start of operation, since fat_trace_start
+    uint32_t duration_ns;
+    uint32_t handle; //file handle id given by traced file_open (or by the first traced use of a handle
+                     //opened before the trace started, such handles have no TRACE_FILE_OPEN), 0 for disk reads
+    int32_t arg0;
+    int32_t arg1;
+    int32_t result;
+    uint8_t op; //enum trace_op_t
+    uint8_t flags;
+    uint16_t thread; //small id of the calling thread
+} __attribute__((__packed__));
+
+//starts recording disk_read/file_open/file_read/file_seek/file_close calls into trace_file_name;
+//returns 0 on success, -1 on error (EBUSY when trace is already running)
+int fat_trace_start(const char *trace_file_name);
+int fat_trace_stop(void);
+
+//hooks used by file_reader.c, trace_enter returns 0 when tracing is off
+uint64_t trace_enter(void);
+void trace_leave(uint64_t start, uint8_t op, uint32_t handle, int32_t arg0, int32_t arg1, int32_t result,
+                 const char *name);
+uint32_t trace_next_handle(void);
+
+#endif //PROJEKT_FAT_FAT_TRACE_H
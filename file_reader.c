@@ -3,16 +3,17 @@
 //
 
 #include "file_reader.h"
+#include "fat_trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
-#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #define SIGNATURE                   (0xAA55)
-#define SECTOR_SIZE                 (512)
 #define MAX_SECTORS_PER_CLUSTER     (64)
 
 #define IS_POWER_TWO(x)             (!((x) & ((x) - 1)) && (x))
@@ -20,18 +21,12 @@
 #define FAT16_MIN_CLUSTERS          (4085)
 #define FAT16_MAX_CLUSTERS          (65525)
 
-#define ATTR_READ_ONLY              (1)
-#define ATTR_HIDDEN                 (2)
-#define ATTR_SYSTEM                 (4)
-#define ATTR_VOLUME_ID              (8)
-#define ATTR_DIRECTORY              (16)
-#define ATTR_ARCHIVE                (32)
+#define STAT_READ_SECTORS           (8) //root directory sectors read at once by file_stat_many
 
-#define DIR_FREE                    (0xE5)
-#define DIR_EOF                     (0x00)
-
-#define NAME_LEN                    (8)
-#define EXT_LEN                     (3)
+#define CHAIN_CACHE_BUCKETS         (1024) //power of two
+#ifndef CHAIN_CACHE_MAX_BYTES
+#define CHAIN_CACHE_MAX_BYTES       (1024 * 1024) //per volume, chains of open files don't count against it
+#endif
 
 //internal
 
@@ -95,50 +90,874 @@ void full_file_name(const struct SFN *entry, char *buf) {
     *(buf + offset) = '\0';
 }
 
-struct cluster_chain_t *read_chain(const struct volume_t *pvolume, const struct SFN *dir_entry) {
-    struct cluster_chain_t *chain = malloc(sizeof(struct cluster_chain_t));
-    if (chain == NULL) {
+struct chain_cache_entry_t {
+    struct cluster_chain_t chain; //has to stay first, file_t only gets a pointer to this part
+    uint16_t first_cluster;
+    uint32_t refs; //open files using the chain
+    struct chain_cache_entry_t *hash_next;
+    struct chain_cache_entry_t *lru_prev;
+    struct chain_cache_entry_t *lru_next;
+};
+
+struct chain_cache_t {
+    pthread_mutex_t lock;
+    struct chain_cache_entry_t *buckets[CHAIN_CACHE_BUCKETS];
+    struct chain_cache_entry_t *lru_head; //unreferenced chains, most recently released first
+    struct chain_cache_entry_t *lru_tail;
+    size_t bytes; //memory taken by all cached chains
+    uint32_t in_use; //chains referenced by open files, volume can't be closed until it drops to 0
+};
+
+size_t chain_entry_bytes(const struct chain_cache_entry_t *entry) {
+    return sizeof(struct chain_cache_entry_t) + entry->chain.size * sizeof(uint16_t);
+}
+
+struct chain_cache_entry_t *read_chain(const struct volume_t *pvolume, uint16_t first_cluster) {
+    struct chain_cache_entry_t *entry = malloc(sizeof(struct chain_cache_entry_t));
+    if (entry == NULL) {
         errno = ENOMEM;
         return NULL;
     }
-    chain->clusters = malloc(sizeof(uint16_t));
+
+    //chain is walked once, capacity doubles so it's not reallocated for every cluster
+    uint32_t capacity = 16;
+    struct cluster_chain_t *chain = &entry->chain;
+    chain->clusters = malloc(capacity * sizeof(uint16_t));
     if (chain->clusters == NULL) {
-        free(chain);
+        free(entry);
         errno = ENOMEM;
         return NULL;
     }
     chain->size = 0;
-    *(chain->clusters + chain->size++) = dir_entry->low_order_address_of_first_cluster;
-    uint16_t next_cluster = *(pvolume->fat + dir_entry->low_order_address_of_first_cluster);
-    while (next_cluster < 0xFFF8) {
-        uint16_t *new_clusters = realloc(chain->clusters, (chain->size + 1) * sizeof(uint16_t));
-        if (new_clusters == NULL) {
-            free(chain->clusters);
-            free(chain);
-            errno = ENOMEM;
-            return NULL;
+
+    //empty file has no clusters, fat[0] holds the media type and isn't a link
+    uint16_t cluster = first_cluster;
+    if (cluster != FAT_FREE_CLUSTER && !volume_cluster_in_range(pvolume, cluster))
+        goto err_ret;
+    while (cluster != FAT_FREE_CLUSTER) {
+        //no chain is longer than the data area, a longer one loops
+        if (chain->size == pvolume->clusters_count)
+            goto err_ret;
+        if (chain->size == capacity) {
+            uint16_t *new_clusters = realloc(chain->clusters, capacity * 2 * sizeof(uint16_t));
+            if (new_clusters == NULL) {
+                free(chain->clusters);
+                free(entry);
+                errno = ENOMEM;
+                return NULL;
+            }
+            chain->clusters = new_clusters;
+            capacity *= 2;
+        }
+
+        *(chain->clusters + chain->size++) = cluster;
+        uint16_t next_cluster = *(pvolume->fat + cluster);
+        if (next_cluster >= FAT_EOC)
+            break;
+        if (!volume_cluster_in_range(pvolume, next_cluster))
+            goto err_ret;
+        cluster = next_cluster;
+    }
+
+    entry->first_cluster = first_cluster;
+    entry->refs = 1;
+    entry->hash_next = entry->lru_prev = entry->lru_next = NULL;
+    return entry;
+
+    err_ret:
+    free(chain->clusters);
+    free(entry);
+    errno = EINVAL;
+    return NULL;
+}
+
+void chain_entry_free(struct chain_cache_entry_t *entry) {
+    free(entry->chain.clusters);
+    free(entry);
+}
+
+struct chain_cache_t *chain_cache_create(void) {
+    struct chain_cache_t *cache = calloc(1, sizeof(struct chain_cache_t));
+    if (cache == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        free(cache);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return cache;
+}
+
+void chain_cache_destroy(struct chain_cache_t *cache) {
+    for (uint32_t i = 0; i < CHAIN_CACHE_BUCKETS; i++) {
+        struct chain_cache_entry_t *entry = cache->buckets[i];
+        while (entry != NULL) {
+            struct chain_cache_entry_t *next = entry->hash_next;
+            chain_entry_free(entry);
+            entry = next;
+        }
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+//both called with cache lock held
+void chain_cache_lru_unlink(struct chain_cache_t *cache, struct chain_cache_entry_t *entry) {
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache->lru_head = entry->lru_next;
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->lru_tail = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+void chain_cache_remove(struct chain_cache_t *cache, struct chain_cache_entry_t *entry) {
+    struct chain_cache_entry_t **link = &cache->buckets[entry->first_cluster & (CHAIN_CACHE_BUCKETS - 1)];
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    cache->bytes -= chain_entry_bytes(entry);
+}
+
+struct chain_cache_entry_t *chain_cache_find(struct chain_cache_t *cache, uint16_t first_cluster) {
+    struct chain_cache_entry_t *entry = cache->buckets[first_cluster & (CHAIN_CACHE_BUCKETS - 1)];
+    while (entry != NULL && entry->first_cluster != first_cluster)
+        entry = entry->hash_next;
+    return entry;
+}
+
+//returns shared, read only chain starting at first_cluster; every call needs matching chain_cache_release
+struct cluster_chain_t *chain_cache_acquire(struct volume_t *pvolume, uint16_t first_cluster) {
+    struct chain_cache_t *cache = pvolume->chain_cache;
+
+    pthread_mutex_lock(&cache->lock);
+    struct chain_cache_entry_t *entry = chain_cache_find(cache, first_cluster);
+    if (entry != NULL) {
+        if (entry->refs++ == 0) {
+            chain_cache_lru_unlink(cache, entry);
+            cache->in_use++;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        return &entry->chain;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    //fat is walked without holding the lock, another thread may have cached the same chain meanwhile
+    struct chain_cache_entry_t *new_entry = read_chain(pvolume, first_cluster);
+    if (new_entry == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = chain_cache_find(cache, first_cluster);
+    if (entry != NULL) {
+        if (entry->refs++ == 0) {
+            chain_cache_lru_unlink(cache, entry);
+            cache->in_use++;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        chain_entry_free(new_entry);
+        return &entry->chain;
+    }
+
+    struct chain_cache_entry_t **bucket = &cache->buckets[first_cluster & (CHAIN_CACHE_BUCKETS - 1)];
+    new_entry->hash_next = *bucket;
+    *bucket = new_entry;
+    cache->bytes += chain_entry_bytes(new_entry);
+    cache->in_use++;
+    pthread_mutex_unlock(&cache->lock);
+    return &new_entry->chain;
+}
+
+void chain_cache_release(struct volume_t *pvolume, struct cluster_chain_t *chain) {
+    struct chain_cache_t *cache = pvolume->chain_cache;
+    struct chain_cache_entry_t *entry = (struct chain_cache_entry_t *) chain;
+
+    pthread_mutex_lock(&cache->lock);
+    if (--entry->refs == 0) {
+        cache->in_use--;
+        entry->lru_next = cache->lru_head;
+        if (cache->lru_head != NULL)
+            cache->lru_head->lru_prev = entry;
+        else
+            cache->lru_tail = entry;
+        cache->lru_head = entry;
+    }
+
+    //only unreferenced chains can go, ones in use may keep the cache above its limit for a while
+    while (cache->bytes > CHAIN_CACHE_MAX_BYTES && cache->lru_tail != NULL) {
+        struct chain_cache_entry_t *victim = cache->lru_tail;
+        chain_cache_lru_unlink(cache, victim);
+        chain_cache_remove(cache, victim);
+        chain_entry_free(victim);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+struct SFN *read_root_dir(const struct volume_t *pvolume) {
+    struct SFN *root_dir = calloc(pvolume->root_sectors_count, pvolume->bytes_per_sector);
+    if (root_dir == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (disk_read(pvolume->disk, pvolume->boot_sectors_count + pvolume->fat_sectors_count, root_dir,
+                  pvolume->root_sectors_count) != 0) {
+        free(root_dir);
+        return NULL;
+    }
+
+    return root_dir;
+}
+
+struct walk_dir_t {
+    uint16_t first_cluster;
+    char *path;
+};
+
+struct walk_t {
+    const struct volume_t *volume;
+    int (*visitor)(void *arg, const struct SFN *entry, const char *path);
+    void *arg;
+
+    struct walk_dir_t *dirs; //queue of directories to read
+    uint32_t dirs_count;
+    uint32_t dirs_capacity;
+    uint8_t *visited; //first clusters of directories already queued
+    int stop; //non-zero value returned by visitor
+};
+
+//returns 1 when end of directory was reached, 0 when more entries may follow, -1 on error or when visitor stopped
+int walk_entries(struct walk_t *walk, const struct SFN *entries, uint32_t count, const char *dir_path) {
+    size_t dir_len = dir_path != NULL ? strlen(dir_path) : 0;
+    char *path = malloc(dir_len + 1 + 13);
+    if (path == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (dir_path != NULL) {
+        memcpy(path, dir_path, dir_len);
+        path[dir_len++] = '\\';
+    }
+
+    int res = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const struct SFN *entry = entries + i;
+        uint8_t first = *((const uint8_t *) entry->filename);
+        if (first == DIR_EOF) {
+            res = 1;
+            break;
+        }
+        if (first == DIR_FREE || first == '.')
+            continue;
+        if (entry->file_attributes == ATTR_LONG_NAME || entry->file_attributes & ATTR_VOLUME_ID)
+            continue;
+
+        full_file_name(entry, path + dir_len);
+
+        //loops and cross-links between directories are not followed, it's up to the caller to report them
+        uint16_t cluster = entry->low_order_address_of_first_cluster;
+        if (entry->file_attributes & ATTR_DIRECTORY && volume_cluster_in_range(walk->volume, cluster) &&
+            !walk->visited[cluster]) {
+            if (walk->dirs_count == walk->dirs_capacity) {
+                uint32_t capacity = walk->dirs_capacity == 0 ? 16 : walk->dirs_capacity * 2;
+                struct walk_dir_t *dirs = realloc(walk->dirs, capacity * sizeof(struct walk_dir_t));
+                if (dirs == NULL) {
+                    errno = ENOMEM;
+                    res = -1;
+                    break;
+                }
+                walk->dirs = dirs;
+                walk->dirs_capacity = capacity;
+            }
+            char *dir = strdup(path);
+            if (dir == NULL) {
+                errno = ENOMEM;
+                res = -1;
+                break;
+            }
+            walk->visited[cluster] = 1;
+            (walk->dirs + walk->dirs_count)->first_cluster = cluster;
+            (walk->dirs + walk->dirs_count)->path = dir;
+            walk->dirs_count++;
+        }
+
+        walk->stop = walk->visitor(walk->arg, entry, path);
+        if (walk->stop != 0) {
+            res = -1;
+            break;
+        }
+    }
+
+    free(path);
+    return res;
+}
+
+int volume_walk(const struct volume_t *pvolume, int (*visitor)(void *arg, const struct SFN *entry, const char *path),
+                void *arg) {
+    if (pvolume == NULL || pvolume->fat == NULL || pvolume->disk == NULL || visitor == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    struct walk_t walk;
+    memset(&walk, 0, sizeof(struct walk_t));
+    walk.volume = pvolume;
+    walk.visitor = visitor;
+    walk.arg = arg;
+    walk.visited = calloc(volume_clusters_limit(pvolume), sizeof(uint8_t));
+    struct SFN *buf = malloc(pvolume->bytes_per_cluster);
+    if (walk.visited == NULL || buf == NULL) {
+        free(walk.visited);
+        free(buf);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int res = 0;
+    if (pvolume->root_entries_count > 0) {
+        struct SFN *root_dir = read_root_dir(pvolume);
+        res = root_dir != NULL ? walk_entries(&walk, root_dir, pvolume->root_entries_count, NULL) : -1;
+        free(root_dir);
+    }
+
+    //queue grows while it's being walked, directories come in breadth first order
+    for (uint32_t i = 0; res != -1 && i < walk.dirs_count; i++) {
+        uint16_t cluster = (walk.dirs + i)->first_cluster;
+        for (uint32_t steps = 0; steps < pvolume->clusters_count; steps++) {
+            uint32_t first_sector = (cluster - 2) * pvolume->sectors_per_cluster + pvolume->first_data_sector;
+            if (disk_read(pvolume->disk, first_sector, buf, pvolume->sectors_per_cluster) != 0) {
+                errno = EIO;
+                res = -1;
+                break;
+            }
+
+            res = walk_entries(&walk, buf, pvolume->bytes_per_cluster / sizeof(struct SFN), (walk.dirs + i)->path);
+            if (res != 0)
+                break;
+
+            uint16_t next = *(pvolume->fat + cluster);
+            if (!volume_cluster_in_range(pvolume, next))
+                break;
+            cluster = next;
+        }
+    }
+
+    for (uint32_t i = 0; i < walk.dirs_count; i++)
+        free((walk.dirs + i)->path);
+    free(walk.dirs);
+    free(walk.visited);
+    free(buf);
+    if (walk.stop != 0)
+        return walk.stop;
+    return res == -1 ? -1 : 0;
+}
+
+uint32_t volume_clusters_limit(const struct volume_t *pvolume) {
+    //fat_open makes sure that fat describes every cluster of the data area
+    return pvolume->clusters_count + FAT_FIRST_CLUSTER;
+}
+
+int volume_cluster_in_range(const struct volume_t *pvolume, uint32_t cluster) {
+    return cluster >= FAT_FIRST_CLUSTER && cluster < volume_clusters_limit(pvolume);
+}
+
+void run_workers(void *(*worker)(void *), void *arg, uint32_t threads_count, uint32_t max_threads) {
+    if (threads_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_count = cpus > 0 ? (uint32_t) cpus : 1;
+    }
+    if (threads_count > max_threads)
+        threads_count = max_threads > 0 ? max_threads : 1;
+
+    //threads which couldn't be started are covered by the ones that were
+    pthread_t *threads = calloc(threads_count, sizeof(pthread_t));
+    uint32_t started = 0;
+    if (threads != NULL) {
+        while (started < threads_count - 1 && pthread_create(threads + started, NULL, worker, arg) == 0)
+            started++;
+    }
+    worker(arg);
+    for (uint32_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+struct lfn_builder_t {
+    uint16_t chars[LFN_MAX_SLOTS * LFN_SLOT_CHARS]; //ucs-2 name, terminated with 0x0000 or 0xFFFF padding
+    uint8_t checksum;
+    uint8_t next_sequence; //sequence number expected in the next slot, 0 when all slots were read
+    uint8_t valid;
+};
+
+uint8_t sfn_checksum(const struct SFN *entry) {
+    uint8_t sum = 0;
+    for (int i = 0; i < NAME_LEN + EXT_LEN; i++)
+        sum = (uint8_t) (((sum & 1) << 7) + (sum >> 1) + (uint8_t) entry->filename[i]);
+    return sum;
+}
+
+void lfn_reset(struct lfn_builder_t *lfn) {
+    lfn->valid = 0;
+}
+
+//slots are stored on disk in reverse order, starting with the one flagged LFN_LAST_SLOT
+void lfn_add_slot(struct lfn_builder_t *lfn, const struct LFN *slot) {
+    uint8_t sequence = slot->sequence & LFN_SEQUENCE_MASK;
+
+    if (slot->sequence & LFN_LAST_SLOT) {
+        lfn->valid = sequence > 0 && sequence <= LFN_MAX_SLOTS;
+        lfn->checksum = slot->checksum;
+        lfn->next_sequence = sequence;
+        //name may fill the last slot completely and then it has no terminator
+        if (lfn->valid && sequence * LFN_SLOT_CHARS < LFN_MAX_SLOTS * LFN_SLOT_CHARS)
+            lfn->chars[sequence * LFN_SLOT_CHARS] = 0x0000;
+    } else if (!lfn->valid || lfn->next_sequence == 0 || sequence == 0 || sequence != lfn->next_sequence ||
+               slot->checksum != lfn->checksum) {
+        //slot with sequence 0 (or one past a complete name) would be written before the buffer
+        lfn->valid = 0;
+    }
+
+    if (!lfn->valid)
+        return;
+
+    uint16_t *chars = lfn->chars + (sequence - 1) * LFN_SLOT_CHARS;
+    memcpy(chars, slot->name1, sizeof(slot->name1));
+    memcpy(chars + 5, slot->name2, sizeof(slot->name2));
+    memcpy(chars + 11, slot->name3, sizeof(slot->name3));
+    lfn->next_sequence--;
+}
+
+int lfn_complete(const struct lfn_builder_t *lfn, const struct SFN *entry) {
+    return lfn->valid && lfn->next_sequence == 0 && lfn->checksum == sfn_checksum(entry);
+}
+
+uint32_t fold_char(uint32_t c) {
+    //ascii and latin-1 supplement, which covers what case folding of 8.3 names ever did
+    if ((c >= 'A' && c <= 'Z') || (c >= 0xC0 && c <= 0xDE && c != 0xD7))
+        return c + 32;
+    return c;
+}
+
+size_t put_utf8(uint32_t c, char *buf) {
+    unsigned char *p = (unsigned char *) buf;
+    if (c < 0x80) {
+        p[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        p[0] = 0xC0 | (c >> 6);
+        p[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    if (c < 0x10000) {
+        p[0] = 0xE0 | (c >> 12);
+        p[1] = 0x80 | ((c >> 6) & 0x3F);
+        p[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    p[0] = 0xF0 | (c >> 18);
+    p[1] = 0x80 | ((c >> 12) & 0x3F);
+    p[2] = 0x80 | ((c >> 6) & 0x3F);
+    p[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+//writes long name as utf-8 (case folded when fold != 0) into buf of LFN_NAME_SIZE bytes, returns its length
+size_t lfn_to_utf8(const struct lfn_builder_t *lfn, char *buf, int fold) {
+    size_t len = 0;
+    for (int i = 0; i < LFN_MAX_CHARS; i++) {
+        uint32_t c = lfn->chars[i];
+        if (c == 0x0000 || c == 0xFFFF)
+            break;
+
+        if (c >= 0xD800 && c <= 0xDBFF && i + 1 < LFN_MAX_CHARS &&
+            lfn->chars[i + 1] >= 0xDC00 && lfn->chars[i + 1] <= 0xDFFF) {
+            c = 0x10000 + ((c - 0xD800) << 10) + (lfn->chars[++i] - 0xDC00);
+        } else if (c >= 0xD800 && c <= 0xDFFF) {
+            c = 0xFFFD;
+        }
+
+        //surrogate pair takes 2 chars and 4 bytes, so LFN_NAME_SIZE is never exceeded
+        len += put_utf8(fold ? fold_char(c) : c, buf + len);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+//case folds utf-8 name into buf of LFN_NAME_SIZE bytes, returns its length or -1 when name is too long
+ssize_t fold_utf8(const char *name, char *buf) {
+    const unsigned char *p = (const unsigned char *) name;
+    size_t len = 0;
+
+    while (*p != '\0') {
+        uint32_t c;
+        int extra;
+        if (*p < 0x80) {
+            c = *p;
+            extra = 0;
+        } else if ((*p & 0xE0) == 0xC0) {
+            c = *p & 0x1F;
+            extra = 1;
+        } else if ((*p & 0xF0) == 0xE0) {
+            c = *p & 0x0F;
+            extra = 2;
+        } else if ((*p & 0xF8) == 0xF0) {
+            c = *p & 0x07;
+            extra = 3;
+        } else {
+            c = 0xFFFD;
+            extra = 0;
+        }
+        p++;
+
+        for (; extra > 0; extra--, p++) {
+            if ((*p & 0xC0) != 0x80) {
+                c = 0xFFFD;
+                break;
+            }
+            c = (c << 6) | (*p & 0x3F);
+        }
+
+        if (len + 4 >= LFN_NAME_SIZE)
+            return -1;
+        len += put_utf8(fold_char(c), buf + len);
+    }
+    buf[len] = '\0';
+    return (ssize_t) len;
+}
+
+//8.3 names are oem bytes, not utf-8, so they are folded byte by byte and only ascii letters change case;
+//buf has LFN_NAME_SIZE bytes, returns length or -1 when name is too long
+ssize_t fold_sfn(const char *name, char *buf) {
+    size_t len = 0;
+    for (; name[len] != '\0'; len++) {
+        if (len + 1 >= LFN_NAME_SIZE)
+            return -1;
+        buf[len] = name[len] >= 'A' && name[len] <= 'Z' ? (char) (name[len] + 32) : name[len];
+    }
+    buf[len] = '\0';
+    return (ssize_t) len;
+}
+
+uint32_t name_hash(const char *key, size_t len) {
+    //fnv-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t) key[i]) * 16777619u;
+    return hash;
+}
+
+size_t utf8_next(const char *s, size_t i, size_t len) {
+    i++;
+    while (i < len && ((uint8_t) s[i] & 0xC0) == 0x80)
+        i++;
+    return i;
+}
+
+//'*' matches any sequence, '?' matches single character (utf-8 sequence when utf8 != 0, single byte otherwise)
+int glob_match(const char *pattern, size_t pattern_len, const char *name, size_t name_len, int utf8) {
+    size_t p = 0, n = 0, star_p = SIZE_MAX, star_n = 0;
+
+    while (n < name_len) {
+        if (p < pattern_len && pattern[p] == '*') {
+            star_p = ++p;
+            star_n = n;
+        } else if (p < pattern_len && pattern[p] == '?') {
+            p++;
+            n = utf8 ? utf8_next(name, n, name_len) : n + 1;
+        } else if (p < pattern_len && pattern[p] == name[n]) {
+            p++;
+            n++;
+        } else if (star_p != SIZE_MAX) {
+            //let the last star eat one more character
+            p = star_p;
+            n = star_n = utf8 ? utf8_next(name, star_n, name_len) : star_n + 1;
+        } else {
+            return 0;
+        }
+    }
+
+    while (p < pattern_len && pattern[p] == '*')
+        p++;
+    return p == pattern_len;
+}
+
+struct stat_query_t {
+    char *keys; //case folded patterns, back to back
+    uint32_t *key_offsets;
+    uint16_t *key_lens;
+    uint8_t *is_glob;
+    uint32_t count;
+    uint32_t globs_count;
+    uint8_t utf8; //keys were folded with fold_utf8
+
+    uint32_t *table; //exact names, open addressing, pattern index + 1 (0 - empty slot)
+    uint32_t table_mask;
+};
+
+void stat_query_free(struct stat_query_t *query) {
+    free(query->keys);
+    free(query->key_offsets);
+    free(query->key_lens);
+    free(query->is_glob);
+    free(query->table);
+}
+
+//fold is fold_utf8 for queries matched against long names and fold_sfn for the ones matched against 8.3 names
+int stat_query_init(struct stat_query_t *query, const char *const *patterns, uint32_t count,
+                    ssize_t (*fold)(const char *, char *)) {
+    memset(query, 0, sizeof(struct stat_query_t));
+    query->count = count;
+    query->utf8 = fold == fold_utf8;
+
+    //patterns are folded twice, first time only to learn how much room they need
+    char key[LFN_NAME_SIZE];
+    size_t keys_size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (patterns[i] == NULL) {
+            errno = EFAULT;
+            return -1;
+        }
+        ssize_t len = fold(patterns[i], key);
+        if (len < 0) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        keys_size += len;
+    }
+
+    uint32_t table_size = 16;
+    while (table_size < count * 2)
+        table_size *= 2;
+
+    query->keys = malloc(keys_size > 0 ? keys_size : 1);
+    query->key_offsets = calloc(count > 0 ? count : 1, sizeof(uint32_t));
+    query->key_lens = calloc(count > 0 ? count : 1, sizeof(uint16_t));
+    query->is_glob = calloc(count > 0 ? count : 1, sizeof(uint8_t));
+    query->table = calloc(table_size, sizeof(uint32_t));
+    if (query->keys == NULL || query->key_offsets == NULL || query->key_lens == NULL || query->is_glob == NULL ||
+        query->table == NULL) {
+        stat_query_free(query);
+        errno = ENOMEM;
+        return -1;
+    }
+    query->table_mask = table_size - 1;
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        ssize_t len = fold(patterns[i], key);
+        memcpy(query->keys + offset, key, len);
+        query->key_offsets[i] = offset;
+        query->key_lens[i] = (uint16_t) len;
+        offset += len;
+
+        if (memchr(key, '*', len) != NULL || memchr(key, '?', len) != NULL) {
+            query->is_glob[i] = 1;
+            query->globs_count++;
+            continue;
+        }
+
+        uint32_t slot = name_hash(key, len) & query->table_mask;
+        while (query->table[slot] != 0) {
+            uint32_t other = query->table[slot] - 1;
+            if (query->key_lens[other] == len && memcmp(query->keys + query->key_offsets[other], key, len) == 0)
+                break;
+            slot = (slot + 1) & query->table_mask;
+        }
+        if (query->table[slot] == 0)
+            query->table[slot] = i + 1;
+    }
+
+    return 0;
+}
+
+//returns index of the first pattern matching the key, -1 when there is none
+int64_t stat_query_match(const struct stat_query_t *query, const char *key, size_t len) {
+    int64_t found = -1;
+
+    uint32_t slot = name_hash(key, len) & query->table_mask;
+    while (query->table[slot] != 0) {
+        uint32_t idx = query->table[slot] - 1;
+        if (query->key_lens[idx] == len && memcmp(query->keys + query->key_offsets[idx], key, len) == 0) {
+            found = idx;
+            break;
         }
+        slot = (slot + 1) & query->table_mask;
+    }
 
-        chain->clusters = new_clusters;
-        *(chain->clusters + chain->size++) = next_cluster;
-        next_cluster = *(pvolume->fat + next_cluster);
+    for (uint32_t i = 0; query->globs_count > 0 && i < query->count && (found == -1 || i < found); i++) {
+        if (query->is_glob[i] && glob_match(query->keys + query->key_offsets[i], query->key_lens[i], key, len,
+                                          query->utf8))
+            return i;
     }
+    return found;
+}
 
-    return chain;
+//one key per name of a root directory entry, entry with a long name has two of them
+struct name_index_entry_t {
+    uint32_t hash;
+    uint32_t key_offset;
+    uint16_t key_len;
+    uint8_t is_long; //key was folded with fold_utf8, fold_sfn otherwise
+    uint8_t attributes;
+    uint16_t position; //index in root directory, the first entry wins when names collide
+    uint16_t first_cluster;
+    uint32_t size;
+};
+
+struct name_index_t {
+    char *keys; //case folded names, back to back
+    size_t keys_size;
+    size_t keys_capacity;
+    struct name_index_entry_t *entries;
+    uint32_t entries_count;
+
+    uint32_t *table; //open addressing, entry index + 1 (0 - empty slot)
+    uint32_t table_mask;
+};
+
+void name_index_free(struct name_index_t *index) {
+    if (index == NULL)
+        return;
+    free(index->keys);
+    free(index->entries);
+    free(index->table);
+    free(index);
 }
 
-int strcasecmp(const char *s1, const char *s2) {
-    const unsigned char *p1 = (const unsigned char *) s1;
-    const unsigned char *p2 = (const unsigned char *) s2;
+//returns index of the entry with given key, -1 when there is none
+int64_t name_index_find(const struct name_index_t *index, const char *key, size_t len, uint8_t is_long) {
+    uint32_t hash = name_hash(key, len);
+    uint32_t slot = hash & index->table_mask;
+    while (index->table[slot] != 0) {
+        const struct name_index_entry_t *entry = index->entries + index->table[slot] - 1;
+        if (entry->hash == hash && entry->key_len == len && entry->is_long == is_long &&
+            memcmp(index->keys + entry->key_offset, key, len) == 0)
+            return index->table[slot] - 1;
+        slot = (slot + 1) & index->table_mask;
+    }
+    return -1;
+}
 
-    int result = 0;
-    if (p1 == p2)
+int name_index_add(struct name_index_t *index, const struct SFN *sfn, uint16_t position, const char *key, size_t len,
+                   uint8_t is_long) {
+    //only the first of entries with the same name can ever be opened
+    if (name_index_find(index, key, len, is_long) != -1)
         return 0;
 
-    while ((result = tolower(*p1) - tolower(*p2++)) == 0)
-        if (*p1++ == '\0')
+    if (index->keys_size + len > index->keys_capacity) {
+        size_t capacity = index->keys_capacity * 2 > index->keys_size + len ?
+                          index->keys_capacity * 2 : index->keys_size + len;
+        char *keys = realloc(index->keys, capacity);
+        if (keys == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        index->keys = keys;
+        index->keys_capacity = capacity;
+    }
+
+    struct name_index_entry_t *entry = index->entries + index->entries_count;
+    entry->hash = name_hash(key, len);
+    entry->key_offset = (uint32_t) index->keys_size;
+    entry->key_len = (uint16_t) len;
+    entry->is_long = is_long;
+    entry->attributes = sfn->file_attributes;
+    entry->position = position;
+    entry->first_cluster = sfn->low_order_address_of_first_cluster;
+    entry->size = sfn->size;
+    memcpy(index->keys + index->keys_size, key, len);
+    index->keys_size += len;
+
+    uint32_t slot = entry->hash & index->table_mask;
+    while (index->table[slot] != 0)
+        slot = (slot + 1) & index->table_mask;
+    index->table[slot] = ++index->entries_count;
+    return 0;
+}
+
+//folds every name of root directory once, so file_open is a hash probe and memcmp
+struct name_index_t *name_index_create(const struct volume_t *pvolume) {
+    struct name_index_t *index = calloc(1, sizeof(struct name_index_t));
+    if (index == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    uint32_t table_size = 16;
+    while (table_size < pvolume->root_entries_count * 4u)
+        table_size *= 2;
+    index->entries = calloc(pvolume->root_entries_count * 2u + 1, sizeof(struct name_index_entry_t));
+    index->table = calloc(table_size, sizeof(uint32_t));
+    if (index->entries == NULL || index->table == NULL) {
+        name_index_free(index);
+        errno = ENOMEM;
+        return NULL;
+    }
+    index->table_mask = table_size - 1;
+    if (pvolume->root_entries_count == 0)
+        return index;
+
+    struct SFN *root_dir = read_root_dir(pvolume);
+    if (root_dir == NULL) {
+        name_index_free(index);
+        return NULL;
+    }
+
+    char key[LFN_NAME_SIZE], temp_name[13];
+    struct lfn_builder_t lfn;
+    lfn_reset(&lfn);
+    for (uint16_t i = 0; i < pvolume->root_entries_count; i++) {
+        const struct SFN *entry = root_dir + i;
+        if (*((uint8_t *) entry->filename) == DIR_EOF)
             break;
-    return result;
+        if (*((uint8_t *) entry->filename) == DIR_FREE) {
+            lfn_reset(&lfn);
+            continue;
+        }
+        if (entry->file_attributes == ATTR_LONG_NAME) {
+            lfn_add_slot(&lfn, (const struct LFN *) entry);
+            continue;
+        }
+
+        int res = 0;
+        if (lfn_complete(&lfn, entry))
+            res = name_index_add(index, entry, i, key, lfn_to_utf8(&lfn, key, 1), 1);
+        lfn_reset(&lfn);
+        full_file_name(entry, temp_name);
+        if (res != 0 || name_index_add(index, entry, i, key, fold_sfn(temp_name, key), 0) != 0) {
+            free(root_dir);
+            name_index_free(index);
+            return NULL;
+        }
+    }
+
+    free(root_dir);
+    return index;
+}
+
+void decode_timestamp(uint16_t date, uint16_t time, uint8_t hundredths, struct file_timestamp_t *timestamp) {
+    timestamp->year = 1980 + (date >> 9);
+    timestamp->month = (date >> 5) & 0x0F;
+    timestamp->day = date & 0x1F;
+    timestamp->hours = time >> 11;
+    timestamp->minutes = (time >> 5) & 0x3F;
+    //time keeps 2 second resolution, creation time has extra 10ms units (0 - 199) on top of it
+    timestamp->seconds = (time & 0x1F) * 2 + hundredths / 100;
+    timestamp->hundredths = hundredths % 100;
+}
+
+uint16_t date_bits(struct date_t date) {
+    return (uint16_t) (date.day | (date.month << 5) | (date.year << 9));
+}
+
+uint16_t time_bits(struct time_t time) {
+    return (uint16_t) (time.seconds | (time.minutes << 5) | (time.hours << 11));
 }
 
 size_t file_read_internal(struct file_t *file, void *buf, size_t to_read) {
@@ -191,6 +1010,11 @@ size_t file_read_internal(struct file_t *file, void *buf, size_t to_read) {
             //and we don't have any data
             //update cluster metadata
             current_cluster_idx = file->offset / file->volume->bytes_per_cluster;
+            //size in directory entry may claim more than the chain holds
+            if (current_cluster_idx >= cluster_chain->size) {
+                errno = ENXIO;
+                return -1;
+            }
             current_cluster = cluster_chain->clusters[current_cluster_idx];
             current_cluster_first_sector = ((current_cluster - 2) * volume->sectors_per_cluster)
                                            + volume->first_data_sector;
@@ -207,13 +1031,13 @@ size_t file_read_internal(struct file_t *file, void *buf, size_t to_read) {
                 return -1;
             }
 
-            //update read pointers
-            file->read_buf_cur = file->read_buf_base + file->offset % volume->bytes_per_cluster;
-            if (current_cluster_idx == cluster_chain->size - 1) {
-                file->read_buf_end = file->read_buf_base + (file->size - file->offset);
-            } else {
-                file->read_buf_end = file->read_buf_base + volume->bytes_per_cluster;
-            }
+            //update read pointers, cluster holding the end of file is read only up to it,
+            //but never past the buffer when size claims more than the chain holds
+            uint32_t in_cluster = file->offset % volume->bytes_per_cluster;
+            file->read_buf_cur = file->read_buf_base + in_cluster;
+            file->read_buf_end = file->read_buf_base + volume->bytes_per_cluster;
+            if (file->size - file->offset < volume->bytes_per_cluster - in_cluster)
+                file->read_buf_end = file->read_buf_cur + (file->size - file->offset);
         }
     }
 
@@ -247,7 +1071,7 @@ struct disk_t *disk_open_from_file(const char *volume_file_name) {
     return disk;
 }
 
-int disk_read(struct disk_t *pdisk, int32_t first_sector, void *buffer, int32_t sectors_to_read) {
+int disk_read_untraced(struct disk_t *pdisk, int32_t first_sector, void *buffer, int32_t sectors_to_read) {
     //check file and buffer
     if (pdisk == NULL || buffer == NULL) {
         errno = EFAULT;
@@ -260,17 +1084,32 @@ int disk_read(struct disk_t *pdisk, int32_t first_sector, void *buffer, int32_t
         return -1;
     }
 
-    if (fseek(pdisk->file, first_sector * SECTOR_SIZE, SEEK_SET) != 0) {
-        return -1;
-    }
-
-    if (fread(buffer, SECTOR_SIZE, sectors_to_read, pdisk->file) != (uint32_t) sectors_to_read) {
-        return -1;
+    //pread doesn't touch the shared file position, so many threads can read from one disk at once
+    char *p = (char *) buffer;
+    size_t remaining = (size_t) sectors_to_read * SECTOR_SIZE;
+    off_t offset = (off_t) first_sector * SECTOR_SIZE;
+    while (remaining > 0) {
+        ssize_t res = pread(fileno(pdisk->file), p, remaining, offset);
+        if (res <= 0) {
+            if (res == -1 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += res;
+        offset += res;
+        remaining -= res;
     }
 
     return 0;
 }
 
+int disk_read(struct disk_t *pdisk, int32_t first_sector, void *buffer, int32_t sectors_to_read) {
+    uint64_t trace_start = trace_enter();
+    int res = disk_read_untraced(pdisk, first_sector, buffer, sectors_to_read);
+    trace_leave(trace_start, TRACE_DISK_READ, 0, first_sector, sectors_to_read, res, NULL);
+    return res;
+}
+
 int disk_close(struct disk_t *pdisk) {
     if (pdisk == NULL || pdisk->file == NULL) {
         errno = EFAULT;
@@ -326,6 +1165,7 @@ struct volume_t *fat_open(struct disk_t *pdisk, uint32_t first_sector) {
         goto err_ret;
 
     volume->fat_sectors_count = boot_sector.number_of_fats * boot_sector.fat_size;
+    volume->fats_count = boot_sector.number_of_fats;
     //according to fatgen10.doc it's should be 1 for fat12/16
     //but they will support anything > 0
     if (boot_sector.reserved_sectors_count == 0)
@@ -363,8 +1203,12 @@ struct volume_t *fat_open(struct disk_t *pdisk, uint32_t first_sector) {
         goto err_ret;
 
     volume->data_sectors_count = data_sectors_count;
+    volume->clusters_count = cluster_count;
     //fat size in bytes = fat sectors * SECTOR SIZE
     uint32_t fat_bytes = boot_sector.fat_size * SECTOR_SIZE;
+    //fat has to describe every cluster of the data area
+    if (fat_bytes / sizeof(uint16_t) < cluster_count + 2)
+        goto err_ret;
     //alloc memory for fat tables
     //uint16_t cuz it only works for fat16
     uint16_t *fats = calloc(boot_sector.number_of_fats, fat_bytes);
@@ -413,6 +1257,20 @@ struct volume_t *fat_open(struct disk_t *pdisk, uint32_t first_sector) {
     volume->fat_size = fat_bytes / sizeof(uint16_t);
     volume->first_data_sector = volume->boot_sectors_count + volume->fat_sectors_count + volume->root_sectors_count;
     free(fats);
+
+    volume->chain_cache = chain_cache_create();
+    if (volume->chain_cache == NULL) {
+        free(volume->fat);
+        free(volume);
+        return NULL;
+    }
+    volume->name_index = name_index_create(volume);
+    if (volume->name_index == NULL) {
+        chain_cache_destroy(volume->chain_cache);
+        free(volume->fat);
+        free(volume);
+        return NULL;
+    }
     return volume;
 
     err_ret:
@@ -427,17 +1285,49 @@ int fat_close(struct volume_t *pvolume) {
         return -1;
     }
 
+    //open files point into cached chains, so they have to be closed first
+    pthread_mutex_lock(&pvolume->chain_cache->lock);
+    uint32_t in_use = pvolume->chain_cache->in_use;
+    pthread_mutex_unlock(&pvolume->chain_cache->lock);
+    if (in_use > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    chain_cache_destroy(pvolume->chain_cache);
+    name_index_free(pvolume->name_index);
     free(pvolume->fat);
     free(pvolume);
     return 0;
 }
 
-struct file_t *file_open(struct volume_t *pvolume, const char *file_name) {
-    if (pvolume == NULL || pvolume->disk == NULL || file_name == NULL) {
+struct file_t *file_open_untraced(struct volume_t *pvolume, const char *file_name) {
+    if (pvolume == NULL || pvolume->disk == NULL || pvolume->name_index == NULL || file_name == NULL) {
         errno = EFAULT;
         return NULL;
     }
 
+    //name is case folded once for long names and once for 8.3 names, the earlier entry wins when both match
+    char key[LFN_NAME_SIZE];
+    const struct name_index_entry_t *found = NULL;
+    ssize_t key_len = fold_utf8(file_name, key);
+    int64_t idx = key_len > 0 ? name_index_find(pvolume->name_index, key, key_len, 1) : -1;
+    if (idx != -1)
+        found = pvolume->name_index->entries + idx;
+    key_len = fold_sfn(file_name, key);
+    idx = key_len > 0 ? name_index_find(pvolume->name_index, key, key_len, 0) : -1;
+    if (idx != -1 && (found == NULL || pvolume->name_index->entries[idx].position < found->position))
+        found = pvolume->name_index->entries + idx;
+
+    if (found == NULL) {
+        errno = ENOENT;
+        return NULL;
+    }
+    if (found->attributes & ATTR_DIRECTORY || found->attributes & ATTR_VOLUME_ID) {
+        errno = EISDIR;
+        return NULL;
+    }
+
     struct file_t *file = malloc(sizeof(struct file_t));
     if (file == NULL) {
         errno = ENOMEM;
@@ -453,76 +1343,64 @@ struct file_t *file_open(struct volume_t *pvolume, const char *file_name) {
         return NULL;
     }
 
-    struct SFN *root_dir = calloc(pvolume->root_sectors_count, pvolume->bytes_per_sector);
-    if (root_dir == NULL) {
+    //broken chain (EINVAL) is reported as it is
+    file->chain = chain_cache_acquire(pvolume, found->first_cluster);
+    if (file->chain == NULL) {
         free(file);
         free(read_buf);
-        errno = ENOMEM;
         return NULL;
     }
+    file->size = found->size;
+    file->volume = pvolume;
+    file->read_buf_base = read_buf;
+    file->read_buf_end = file->read_buf_cur = read_buf + pvolume->bytes_per_cluster;
+    file->offset = 0;
+    file->trace_id = 0;
+    return file;
+}
 
-    if (disk_read(pvolume->disk, pvolume->boot_sectors_count + pvolume->fat_sectors_count, root_dir,
-                  pvolume->root_sectors_count) != 0) {
-        free(file);
-        free(read_buf);
-        free(root_dir);
-        return NULL;
-    }
-    char temp_name[13];
-    for (uint16_t i = 0; i < pvolume->root_entries_count; i++) {
-        if (*((uint8_t *) (root_dir + i)->filename) == DIR_EOF)
-            break;
-        if (*((uint8_t *) (root_dir + i)->filename) == DIR_FREE)
-            continue;
-
-        full_file_name((root_dir + i), temp_name);
-        if (strcasecmp(temp_name, file_name) == 0) {
-            if ((root_dir + i)->file_attributes & ATTR_DIRECTORY || (root_dir + i)->file_attributes & ATTR_VOLUME_ID) {
-                free(file);
-                free(root_dir);
-                free(read_buf);
-                errno = EISDIR;
-                return NULL;
-            }
-            file->chain = read_chain(pvolume, root_dir + i);
-            if (file->chain == NULL) {
-                if (errno != ENOMEM)
-                    errno = EFAULT;
-                free(file);
-                free(root_dir);
-                free(read_buf);
-                return NULL;
-            }
-            file->size = (root_dir + i)->size;
-            file->volume = pvolume;
-            file->read_buf_base = read_buf;
-            file->read_buf_end = file->read_buf_cur = read_buf + pvolume->bytes_per_cluster;
-            file->offset = 0;
-            free(root_dir);
-            return file;
-        }
+struct file_t *file_open(struct volume_t *pvolume, const char *file_name) {
+    uint64_t trace_start = trace_enter();
+    struct file_t *file = file_open_untraced(pvolume, file_name);
+    if (trace_start != 0) {
+        if (file != NULL)
+            file->trace_id = trace_next_handle();
+        int32_t name_len = file_name != NULL ? (int32_t) strlen(file_name) : 0;
+        trace_leave(trace_start, TRACE_FILE_OPEN, file != NULL ? file->trace_id : 0, name_len, 0,
+                    file != NULL ? 0 : errno, file_name);
     }
-
-    free(file);
-    free(root_dir);
-    free(read_buf);
-    errno = ENOENT;
-    return NULL;
+    return file;
 }
 
-int file_close(struct file_t *stream) {
+int file_close_untraced(struct file_t *stream) {
     if (stream == NULL || stream->chain == NULL) {
         errno = EFAULT;
         return 1;
     }
-    free(stream->chain->clusters);
-    free(stream->chain);
+    chain_cache_release(stream->volume, stream->chain);
     free(stream->read_buf_base);
     free(stream);
     return 0;
 }
 
-size_t file_read(void *ptr, size_t size, size_t nmemb, struct file_t *stream) {
+//handles opened before tracing started get their id when they are used for the first time while it's on
+uint32_t file_trace_id(struct file_t *stream, uint64_t trace_start) {
+    if (stream == NULL || trace_start == 0)
+        return 0;
+    if (stream->trace_id == 0)
+        stream->trace_id = trace_next_handle();
+    return stream->trace_id;
+}
+
+int file_close(struct file_t *stream) {
+    uint64_t trace_start = trace_enter();
+    uint32_t handle = file_trace_id(stream, trace_start);
+    int res = file_close_untraced(stream);
+    trace_leave(trace_start, TRACE_FILE_CLOSE, handle, 0, 0, res, NULL);
+    return res;
+}
+
+size_t file_read_untraced(void *ptr, size_t size, size_t nmemb, struct file_t *stream) {
     if (ptr == NULL || stream == NULL || stream->chain == NULL || stream->volume == NULL) {
         errno = EFAULT;
         return -1;
@@ -540,7 +1418,15 @@ size_t file_read(void *ptr, size_t size, size_t nmemb, struct file_t *stream) {
     return read == requested ? nmemb : read / size;
 }
 
-int32_t file_seek(struct file_t *stream, int32_t offset, int whence) {
+size_t file_read(void *ptr, size_t size, size_t nmemb, struct file_t *stream) {
+    uint64_t trace_start = trace_enter();
+    size_t res = file_read_untraced(ptr, size, nmemb, stream);
+    trace_leave(trace_start, TRACE_FILE_READ, file_trace_id(stream, trace_start), (int32_t) size,
+                (int32_t) nmemb, (int32_t) res, NULL);
+    return res;
+}
+
+int32_t file_seek_untraced(struct file_t *stream, int32_t offset, int whence) {
     if (stream == NULL) {
         errno = EFAULT;
         return -1;
@@ -586,6 +1472,13 @@ int32_t file_seek(struct file_t *stream, int32_t offset, int whence) {
     return 0;
 }
 
+int32_t file_seek(struct file_t *stream, int32_t offset, int whence) {
+    uint64_t trace_start = trace_enter();
+    int32_t res = file_seek_untraced(stream, offset, whence);
+    trace_leave(trace_start, TRACE_FILE_SEEK, file_trace_id(stream, trace_start), offset, whence, res, NULL);
+    return res;
+}
+
 struct dir_t *dir_open(struct volume_t *pvolume, const char *dir_path) {
     if (pvolume == NULL || dir_path == NULL) {
         errno = EFAULT;
@@ -624,23 +1517,40 @@ int dir_read(struct dir_t *pdir, struct dir_entry_t *pentry) {
     }
 
     struct SFN buf[SECTOR_SIZE / sizeof(struct SFN)];
+    uint32_t loaded_sector = UINT32_MAX;
+    struct lfn_builder_t lfn;
+    lfn_reset(&lfn);
     while (pdir->index <= pdir->count) {
         uint8_t entry_idx = pdir->index % 16;
         uint32_t sector_idx = pdir->index / 16;
-        if (disk_read(pdir->volume->disk,
-                      pdir->volume->boot_sectors_count + pdir->volume->fat_sectors_count + sector_idx, buf,
-                      1) != 0) {
-            errno = EIO;
-            return -1;
+        if (sector_idx != loaded_sector) {
+            if (disk_read(pdir->volume->disk,
+                          pdir->volume->boot_sectors_count + pdir->volume->fat_sectors_count + sector_idx, buf,
+                          1) != 0) {
+                errno = EIO;
+                return -1;
+            }
+            loaded_sector = sector_idx;
         }
         if (*((uint8_t *) buf[entry_idx].filename) == DIR_EOF)
             break;
         if (*((uint8_t *) buf[entry_idx].filename) == DIR_FREE) {
+            lfn_reset(&lfn);
+            pdir->index += 1;
+            continue;
+        }
+        //long name slots precede their 8.3 entry, so they are collected within a single call
+        if (buf[entry_idx].file_attributes == ATTR_LONG_NAME) {
+            lfn_add_slot(&lfn, (const struct LFN *) &buf[entry_idx]);
             pdir->index += 1;
             continue;
         }
 
         full_file_name(&buf[entry_idx], pentry->name);
+        if (lfn_complete(&lfn, &buf[entry_idx]))
+            lfn_to_utf8(&lfn, pentry->long_name, 0);
+        else
+            pentry->long_name[0] = '\0';
         pentry->size = buf[entry_idx].size;
         pentry->is_archived = buf[entry_idx].file_attributes & ATTR_ARCHIVE;
         pentry->is_readonly = buf[entry_idx].file_attributes & ATTR_READ_ONLY;
@@ -662,3 +1572,97 @@ int dir_close(struct dir_t *pdir) {
     free(pdir);
     return 0;
 }
+
+int file_stat_many(struct volume_t *pvolume, const char *const *patterns, uint32_t patterns_count,
+                   struct file_stat_t *entries, uint32_t capacity, uint32_t *count) {
+    if (pvolume == NULL || pvolume->disk == NULL || (patterns == NULL && patterns_count > 0) ||
+        (entries == NULL && capacity > 0) || count == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    //long names are utf-8 and 8.3 names are oem bytes, so each of them is matched against its own folding
+    struct stat_query_t query, short_query;
+    if (stat_query_init(&query, patterns, patterns_count, fold_utf8) != 0)
+        return -1;
+    if (stat_query_init(&short_query, patterns, patterns_count, fold_sfn) != 0) {
+        stat_query_free(&query);
+        return -1;
+    }
+
+    //directory is read in chunks straight into a stack buffer, nothing is allocated per entry
+    struct SFN buf[STAT_READ_SECTORS * SECTOR_SIZE / sizeof(struct SFN)];
+    const uint32_t entries_per_sector = SECTOR_SIZE / sizeof(struct SFN);
+    char key[LFN_NAME_SIZE], temp_name[13];
+    struct lfn_builder_t lfn;
+    lfn_reset(&lfn);
+    uint32_t matched = 0;
+    int eof = 0;
+
+    for (uint32_t sector = 0; !eof && sector < pvolume->root_sectors_count; sector += STAT_READ_SECTORS) {
+        uint32_t sectors = pvolume->root_sectors_count - sector < STAT_READ_SECTORS ?
+                           pvolume->root_sectors_count - sector : STAT_READ_SECTORS;
+        if (disk_read(pvolume->disk, pvolume->boot_sectors_count + pvolume->fat_sectors_count + sector, buf,
+                      sectors) != 0) {
+            stat_query_free(&query);
+            stat_query_free(&short_query);
+            errno = EIO;
+            return -1;
+        }
+
+        for (uint32_t i = 0; i < sectors * entries_per_sector; i++) {
+            const struct SFN *entry = buf + i;
+            if (sector * entries_per_sector + i >= pvolume->root_entries_count ||
+                *((uint8_t *) entry->filename) == DIR_EOF) {
+                eof = 1;
+                break;
+            }
+            if (*((uint8_t *) entry->filename) == DIR_FREE) {
+                lfn_reset(&lfn);
+                continue;
+            }
+            if (entry->file_attributes == ATTR_LONG_NAME) {
+                lfn_add_slot(&lfn, (const struct LFN *) entry);
+                continue;
+            }
+
+            //long name may match on its own, otherwise 8.3 name is tried
+            int has_long_name = lfn_complete(&lfn, entry);
+            int64_t pattern = -1;
+            if (!(entry->file_attributes & ATTR_VOLUME_ID)) {
+                if (has_long_name)
+                    pattern = stat_query_match(&query, key, lfn_to_utf8(&lfn, key, 1));
+                full_file_name(entry, temp_name);
+                int64_t short_pattern = stat_query_match(&short_query, key, fold_sfn(temp_name, key));
+                if (short_pattern != -1 && (pattern == -1 || short_pattern < pattern))
+                    pattern = short_pattern;
+            }
+
+            if (pattern != -1 && matched < capacity) {
+                struct file_stat_t *stat = entries + matched;
+                strcpy(stat->name, temp_name);
+                if (has_long_name)
+                    lfn_to_utf8(&lfn, stat->long_name, 0);
+                else
+                    stat->long_name[0] = '\0';
+                stat->size = entry->size;
+                stat->attributes = entry->file_attributes;
+                stat->first_cluster = entry->low_order_address_of_first_cluster;
+                decode_timestamp(date_bits(entry->creation_date), time_bits(entry->creation_time),
+                                 entry->file_creation_time, &stat->created);
+                decode_timestamp(date_bits(entry->modified_date), time_bits(entry->modified_time), 0,
+                                 &stat->modified);
+                decode_timestamp(entry->access_date, 0, 0, &stat->accessed);
+                stat->pattern = (uint32_t) pattern;
+            }
+            if (pattern != -1)
+                matched++;
+            lfn_reset(&lfn);
+        }
+    }
+
+    stat_query_free(&query);
+    stat_query_free(&short_query);
+    *count = matched;
+    return 0;
+}
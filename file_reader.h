@@ -8,6 +8,34 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#define SECTOR_SIZE                 (512)
+
+#define ATTR_READ_ONLY              (1)
+#define ATTR_HIDDEN                 (2)
+#define ATTR_SYSTEM                 (4)
+#define ATTR_VOLUME_ID              (8)
+#define ATTR_DIRECTORY              (16)
+#define ATTR_ARCHIVE                (32)
+#define ATTR_LONG_NAME              (ATTR_READ_ONLY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID)
+
+#define DIR_FREE                    (0xE5)
+#define DIR_EOF                     (0x00)
+
+#define NAME_LEN                    (8)
+#define EXT_LEN                     (3)
+
+#define LFN_LAST_SLOT               (0x40) //sequence flag of the last (first on disk) slot
+#define LFN_SEQUENCE_MASK           (0x1F)
+#define LFN_SLOT_CHARS              (13)
+#define LFN_MAX_SLOTS               (20)
+#define LFN_MAX_CHARS               (255)
+#define LFN_NAME_SIZE               (LFN_MAX_CHARS * 3 + 1) //utf-8 bytes of the longest name with terminator
+
+#define FAT_FREE_CLUSTER            (0x0000)
+#define FAT_FIRST_CLUSTER           (0x0002)
+#define FAT_BAD_CLUSTER             (0xFFF7)
+#define FAT_EOC                     (0xFFF8) //values >= FAT_EOC terminate a chain
+
 //disk
 
 struct disk_t {
@@ -33,24 +61,32 @@ struct volume_t {
 
     uint16_t boot_sectors_count; //boot sectors count
     uint16_t fat_sectors_count; //all sectors count from fats
+    uint8_t fats_count; //number of fat copies
 
     uint32_t root_sectors_count; //root sectors count
 
     uint32_t data_sectors_count; //data sectors count
     uint32_t first_data_sector; //first data sector number
+    uint32_t clusters_count; //data clusters count (valid clusters are 2..clusters_count + 1)
 
     uint16_t root_entries_count; //root entries
 
 
     uint16_t *fat; //fat table
-    uint16_t fat_size; //how many entries in fat
+    uint32_t fat_size; //how many entries in fat (65536 for 256 sector fat, so it doesn't fit in 16 bits)
+
+    struct chain_cache_t *chain_cache; //cluster chains shared by open files, keyed by first cluster
+    struct name_index_t *name_index; //case folded root directory names, built by fat_open for file_open
 };
 
 struct volume_t* fat_open(struct disk_t* pdisk, uint32_t first_sector);
+//every file opened on the volume has to be closed first, otherwise fat_close fails with EBUSY
+//and the volume stays open
 int fat_close(struct volume_t* pvolume);
 
 // file
 
+//chains are shared between all files opened with the same first cluster, don't modify them
 struct cluster_chain_t {
     uint16_t *clusters;
     uint32_t size;
@@ -64,6 +100,7 @@ struct file_t {
     struct cluster_chain_t *chain;
     uint32_t offset;
     uint32_t size; //size of file
+    uint32_t trace_id; //handle id used in io trace, 0 until file is opened or first used while tracing
 };
 
 struct file_t* file_open(struct volume_t* pvolume, const char* file_name);
@@ -103,6 +140,17 @@ struct SFN {
     uint32_t size;
 } __attribute__((__packed__));
 
+struct LFN {
+    uint8_t sequence;
+    uint16_t name1[5];
+    uint8_t file_attributes; //always ATTR_LONG_NAME
+    uint8_t type;
+    uint8_t checksum; //checksum of 8.3 name of the entry following the slots
+    uint16_t name2[6];
+    uint16_t first_cluster; //always 0
+    uint16_t name3[2];
+} __attribute__((__packed__));
+
 struct dir_t {
     struct volume_t *volume;
     uint16_t count;
@@ -111,6 +159,7 @@ struct dir_t {
 
 struct dir_entry_t {
     char name[13];
+    char long_name[LFN_NAME_SIZE]; //utf-8, empty when entry has no (valid) long name
     uint32_t size;
     int8_t is_archived : 1;
     int8_t is_readonly : 1;
@@ -123,4 +172,53 @@ struct dir_t* dir_open(struct volume_t* pvolume, const char* dir_path);
 int dir_read(struct dir_t* pdir, struct dir_entry_t* pentry);
 int dir_close(struct dir_t* pdir);
 
+// batch stat
+
+struct file_timestamp_t {
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hours;
+    uint8_t minutes;
+    uint8_t seconds;
+    uint8_t hundredths;
+};
+
+struct file_stat_t {
+    char name[13];
+    char long_name[LFN_NAME_SIZE]; //utf-8, empty when entry has no (valid) long name
+    uint32_t size;
+    uint8_t attributes;
+    uint16_t first_cluster;
+    struct file_timestamp_t created;
+    struct file_timestamp_t modified;
+    struct file_timestamp_t accessed; //date only
+    uint32_t pattern; //index of the first pattern matching the entry
+};
+
+//matches every root directory entry against names or glob patterns ('*', '?'), case insensitive,
+//on long and 8.3 names, in a single pass over directory sectors; up to capacity matches are stored
+//in entries, *count gets number of all matches; returns 0 on success, -1 on error
+int file_stat_many(struct volume_t* pvolume, const char* const* patterns, uint32_t patterns_count,
+                   struct file_stat_t* entries, uint32_t capacity, uint32_t* count);
+
+// internal helpers shared with the tools
+
+void full_file_name(const struct SFN *entry, char *buf);
+struct SFN *read_root_dir(const struct volume_t *pvolume);
+
+//calls visitor for every file and directory of the root directory and then, breadth first, of every reachable
+//subdirectory (each directory is read once, even when entries loop or cross-link); path is made of 8.3 names
+//joined with '\\'; walk stops when visitor returns non-zero and volume_walk returns that value, -1 on error
+int volume_walk(const struct volume_t *pvolume, int (*visitor)(void *arg, const struct SFN *entry, const char *path),
+                void *arg);
+
+//first cluster number past the data area, valid clusters are FAT_FIRST_CLUSTER..limit - 1
+uint32_t volume_clusters_limit(const struct volume_t *pvolume);
+int volume_cluster_in_range(const struct volume_t *pvolume, uint32_t cluster);
+
+//runs worker(arg) on threads_count threads (0 - one per cpu), but never on more than max_threads of them
+//(at least 1), calling thread is one of the workers; returns when all of them are done
+void run_workers(void *(*worker)(void *), void *arg, uint32_t threads_count, uint32_t max_threads);
+
 #endif //PROJEKT_FAT_FILE_READER_H
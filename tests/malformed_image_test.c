@@ -0,0 +1,231 @@
+//
+// Created by root on 10/18/26.
+//
+
+//opens small hand made FAT16 images with broken metadata, everything has to fail cleanly
+//(run under -fsanitize=address to catch out of bounds accesses)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "../file_reader.h"
+
+#define TEST_RESERVED_SECTORS       (1)
+#define TEST_FATS_COUNT             (2)
+#define TEST_FAT_SECTORS            (17)
+#define TEST_ROOT_ENTRIES           (512)
+#define TEST_CLUSTERS               (4200) //smallest count that is still FAT16 is 4085
+#define TEST_ROOT_SECTOR            (TEST_RESERVED_SECTORS + TEST_FATS_COUNT * TEST_FAT_SECTORS)
+#define TEST_DATA_SECTOR            (TEST_ROOT_SECTOR + TEST_ROOT_ENTRIES * 32 / SECTOR_SIZE)
+#define TEST_TOTAL_SECTORS          (TEST_DATA_SECTOR + TEST_CLUSTERS)
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+struct image_t {
+    uint8_t sectors[TEST_TOTAL_SECTORS][SECTOR_SIZE];
+    uint16_t fat[TEST_FAT_SECTORS * SECTOR_SIZE / sizeof(uint16_t)];
+    struct SFN *root;
+    uint32_t root_count;
+};
+
+//boot sector fields aren't aligned
+static void put16(uint8_t *p, uint16_t value) {
+    memcpy(p, &value, sizeof(uint16_t));
+}
+
+static void image_init(struct image_t *image, uint8_t media_type) {
+    memset(image, 0, sizeof(struct image_t));
+    uint8_t *boot = image->sectors[0];
+    memcpy(boot + 3, "MSWIN4.1", 8);
+    put16(boot + 11, SECTOR_SIZE);
+    boot[13] = 1; //sectors per cluster
+    put16(boot + 14, TEST_RESERVED_SECTORS);
+    boot[16] = TEST_FATS_COUNT;
+    put16(boot + 17, TEST_ROOT_ENTRIES);
+    put16(boot + 19, TEST_TOTAL_SECTORS);
+    boot[21] = media_type;
+    put16(boot + 22, TEST_FAT_SECTORS);
+    put16(boot + 510, 0xAA55);
+
+    image->fat[0] = 0xFF00 | media_type;
+    image->fat[1] = 0xFFFF;
+    image->root = (struct SFN *) image->sectors[TEST_ROOT_SECTOR];
+}
+
+static uint8_t checksum(const char *name11) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++)
+        sum = (uint8_t) (((sum & 1) << 7) + (sum >> 1) + (uint8_t) name11[i]);
+    return sum;
+}
+
+static void add_slot(struct image_t *image, uint8_t sequence, const char *name11, const char *part) {
+    struct LFN *slot = (struct LFN *) (image->root + image->root_count++);
+    uint16_t chars[LFN_SLOT_CHARS];
+    size_t len = strlen(part);
+    for (size_t i = 0; i < LFN_SLOT_CHARS; i++)
+        chars[i] = i < len ? (uint8_t) part[i] : i == len ? 0x0000 : 0xFFFF;
+
+    slot->sequence = sequence;
+    slot->file_attributes = ATTR_LONG_NAME;
+    slot->checksum = checksum(name11);
+    memcpy(slot->name1, chars, sizeof(slot->name1));
+    memcpy(slot->name2, chars + 5, sizeof(slot->name2));
+    memcpy(slot->name3, chars + 11, sizeof(slot->name3));
+}
+
+static void add_file(struct image_t *image, const char *name11, uint16_t first_cluster, uint32_t size) {
+    struct SFN *entry = image->root + image->root_count++;
+    memcpy(entry->filename, name11, 11);
+    entry->file_attributes = ATTR_ARCHIVE;
+    entry->low_order_address_of_first_cluster = first_cluster;
+    entry->size = size;
+}
+
+static int image_write(struct image_t *image, char *path) {
+    for (int i = 0; i < TEST_FATS_COUNT; i++)
+        memcpy(image->sectors[TEST_RESERVED_SECTORS + i * TEST_FAT_SECTORS], image->fat, sizeof(image->fat));
+
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return -1;
+    FILE *f = fdopen(fd, "wb");
+    if (f == NULL) {
+        close(fd);
+        return -1;
+    }
+    int res = fwrite(image->sectors, sizeof(image->sectors), 1, f) == 1 ? 0 : -1;
+    if (fclose(f) != 0)
+        res = -1;
+    return res;
+}
+
+//complete long name followed by a stray slot whose sequence masks to 0, then slots out of range
+static void test_stray_lfn_slot(struct image_t *image) {
+    image_init(image, 0xF8);
+    image->fat[2] = 0xFFFF;
+    image->fat[3] = 0xFFFF;
+    add_slot(image, LFN_LAST_SLOT | 1, "A       TXT", "long name.a");
+    add_slot(image, 0x20, "A       TXT", "stray");
+    add_file(image, "A       TXT", 2, 5);
+    add_slot(image, LFN_LAST_SLOT, "B       TXT", "zero");
+    add_slot(image, LFN_LAST_SLOT | 1, "B       TXT", "Good Name.b");
+    add_slot(image, LFN_SEQUENCE_MASK, "B       TXT", "too far");
+    add_slot(image, LFN_LAST_SLOT | 1, "B       TXT", "Good Name.b");
+    add_file(image, "B       TXT", 3, 5);
+
+    char path[] = "/tmp/fat_test_XXXXXX";
+    CHECK(image_write(image, path) == 0);
+    struct disk_t *disk = disk_open_from_file(path);
+    CHECK(disk != NULL);
+    struct volume_t *volume = fat_open(disk, 0);
+    CHECK(volume != NULL);
+    if (volume == NULL) {
+        disk_close(disk);
+        unlink(path);
+        return;
+    }
+
+    struct dir_t *dir = dir_open(volume, "\\");
+    CHECK(dir != NULL);
+    struct dir_entry_t entry;
+    CHECK(dir_read(dir, &entry) == 0 && strcmp(entry.name, "A.TXT") == 0 && entry.long_name[0] == '\0');
+    CHECK(dir_read(dir, &entry) == 0 && strcmp(entry.name, "B.TXT") == 0 &&
+          strcmp(entry.long_name, "Good Name.b") == 0);
+    CHECK(dir_read(dir, &entry) == 1);
+    dir_close(dir);
+
+    const char *patterns[] = {"*"};
+    struct file_stat_t stats[4];
+    uint32_t count = 0;
+    CHECK(file_stat_many(volume, patterns, 1, stats, 4, &count) == 0 && count == 2);
+    CHECK(count == 2 && stats[0].long_name[0] == '\0' && strcmp(stats[1].long_name, "Good Name.b") == 0);
+
+    errno = 0;
+    CHECK(file_open(volume, "long name.a") == NULL && errno == ENOENT);
+    struct file_t *file = file_open(volume, "good name.B");
+    CHECK(file != NULL && file->size == 5);
+    if (file != NULL)
+        file_close(file);
+
+    CHECK(fat_close(volume) == 0);
+    disk_close(disk);
+    unlink(path);
+}
+
+//empty file on 0xF0 media, chains that loop or leave the data area, size larger than the chain
+static void test_broken_chains(struct image_t *image) {
+    image_init(image, 0xF0);
+    add_file(image, "EMPTY   DAT", FAT_FREE_CLUSTER, 0);
+    image->fat[2] = 3;
+    image->fat[3] = 4;
+    image->fat[4] = 2;
+    add_file(image, "LOOP    DAT", 2, 3 * SECTOR_SIZE);
+    image->fat[5] = 0xF000;
+    add_file(image, "FAR     DAT", 5, 2 * SECTOR_SIZE);
+    add_file(image, "OUTSIDE DAT", 0xF000, SECTOR_SIZE);
+    image->fat[6] = 0xFFFF;
+    add_file(image, "SHORT   DAT", 6, 4 * SECTOR_SIZE);
+
+    char path[] = "/tmp/fat_test_XXXXXX";
+    CHECK(image_write(image, path) == 0);
+    struct disk_t *disk = disk_open_from_file(path);
+    CHECK(disk != NULL);
+    struct volume_t *volume = fat_open(disk, 0);
+    CHECK(volume != NULL);
+    if (volume == NULL) {
+        disk_close(disk);
+        unlink(path);
+        return;
+    }
+
+    char buf[4 * SECTOR_SIZE];
+    struct file_t *file = file_open(volume, "EMPTY.DAT");
+    CHECK(file != NULL && file_read(buf, 1, sizeof(buf), file) == 0);
+    if (file != NULL)
+        file_close(file);
+
+    errno = 0;
+    CHECK(file_open(volume, "LOOP.DAT") == NULL && errno == EINVAL);
+    errno = 0;
+    CHECK(file_open(volume, "FAR.DAT") == NULL && errno == EINVAL);
+    errno = 0;
+    CHECK(file_open(volume, "OUTSIDE.DAT") == NULL && errno == EINVAL);
+
+    file = file_open(volume, "SHORT.DAT");
+    CHECK(file != NULL && file_read(buf, 1, sizeof(buf), file) == (size_t) -1 && errno == ENXIO);
+    if (file != NULL)
+        file_close(file);
+
+    CHECK(fat_close(volume) == 0);
+    disk_close(disk);
+    unlink(path);
+}
+
+int main(void) {
+    struct image_t *image = malloc(sizeof(struct image_t));
+    if (image == NULL)
+        return 2;
+
+    test_stray_lfn_slot(image);
+    test_broken_chains(image);
+
+    free(image);
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}